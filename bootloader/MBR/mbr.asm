@@ -11,7 +11,8 @@ global __bootstrap
 %define SSL_ADDR        0x10000
 %define SSL_SIZE        64 * 1024
 %define SSL_SEG         SSL_ADDR >> 4
-%define SSL_SECTORS     SSL_SIZE / 512 - 1  ; FIXME: Some BIOSes can't read more than 127 sectors
+%define SSL_CHUNK       64                  ; Sectors per read, accepted by all BIOSes
+%define SSL_CHUNKS      SSL_SIZE / (SSL_CHUNK * SECTOR_SIZE)
 
 %define BUFF_ADDR       SSL_ADDR
 %define BUFF_SEG        BUFF_ADDR >> 4
@@ -154,12 +155,20 @@ start:
     ; Update DAP
     mov dword [DAP.lba_low], eax
     mov dword [DAP.lba_high], ebx
-    mov word [DAP.sectors], SSL_SECTORS
+    mov word [DAP.sectors], SSL_CHUNK
 
-    ; Load SSL to memory
+    ; Load SSL to memory in chunks
+    mov cx, SSL_CHUNKS
+.load:
+    push cx
     call read_drive
+    pop cx
     mov al, '7'
     jc short .fail
+    add word [DAP.segment], (SSL_CHUNK * SECTOR_SIZE) >> 4
+    add dword [DAP.lba_low], SSL_CHUNK
+    adc dword [DAP.lba_high], 0
+    loop .load
 
     ; Far jump to SSL
     jmp SSL_SEG:0x0000
@@ -200,7 +209,7 @@ print:
 ; OUTPUT: CF is set on error, clear on success
 ; LIMITATIONS: 
 ;   - Maximum buffer size is 64KB (1 real mode segment)
-;   - Some BIOSes can't read more than 127 sectors
+;   - Some BIOSes can't read more than 127 sectors, so keep reads small
 read_drive:
     mov ah, 0x42
     mov dl, byte [drive_number]
@@ -51,6 +51,55 @@ typedef struct __packed DAP {
   qword_t lba;
 } DAP;
 
+/**
+ * @struct DAP64
+ * @brief EDD 3.0 Disk Address Packet
+ * @details Used by BIOS int 13h for reading/writing drive to 64bit flat
+ * buffer address. \ref DAP64::segment "Segment" and \ref DAP64::offset
+ * "offset" must be FFFF:FFFF
+ *
+ * @typedef DAP64
+ * @brief DAP64 type
+ *
+ */
+typedef struct __packed DAP64 {
+  /**
+   * @brief Size of the DAP. Must be 24 or sizeof(DAP64)
+   *
+   */
+  byte_t  size;
+  /**
+   * @brief Reserved. Always 0
+   *
+   */
+  byte_t  rsv;
+  /**
+   * @brief Number of sectors to read/write
+   *
+   */
+  word_t  sectors;
+  /**
+   * @brief Must be FFFFh
+   *
+   */
+  word_t  offset;
+  /**
+   * @brief Must be FFFFh
+   *
+   */
+  word_t  segment;
+  /**
+   * @brief LBA of the drive
+   *
+   */
+  qword_t lba;
+  /**
+   * @brief 64bit flat address of Read/Write buffer
+   *
+   */
+  qword_t flat_address;
+} DAP64;
+
 /**
  * @struct drive_parameteres
  * @brief Parameteres of the drive
@@ -107,7 +156,9 @@ void             bios_putch(byte_t ch);
 
 /**
  * @brief Read drive using BIOS int 13h
- * @details Can read 128 sectors on all BIOSes
+ * @details Splits the request into the largest transfers accepted by BIOS
+ * (see \ref bios_probe_max_transfer). Failed transfers are retried after drive
+ * reset and then splitted into smaller ones
  *
  * @param [in] read_context Pointer to DAP
  * @return true on success
@@ -115,6 +166,56 @@ void             bios_putch(byte_t ch);
  */
 bool __check_ret bios_read_drive(const DAP* read_context);
 
+/**
+ * @brief Detect EDD 3.0 flat buffer addressing, using BIOS int 13h
+ * @details Checks int 13h AH=41h and AH=48h for EDD 3.0 and verifies that the
+ * BIOS really reads into a flat buffer by reading the GPT header to scratch
+ * memory. On success \ref bios_read_drive_linear reads straight into the
+ * destination
+ *
+ * @param [in] scratch Linear address of at least one sector of scratch memory
+ * above 1MB
+ * @return true if flat buffer addressing is used
+ * @return false if reads go through the bounce buffer
+ */
+bool             bios_detect_flat_reads(dword_t scratch);
+
+/**
+ * @brief Read drive to linear address, using BIOS int 13h
+ * @details Uses EDD 3.0 flat buffer addressing if it was detected by \ref
+ * bios_detect_flat_reads, otherwise reads through the bounce buffer below 1MB
+ * and copies the data in Unreal mode. Falls back to the bounce buffer if a
+ * flat read fails
+ *
+ * @param [in] lba First LBA to read
+ * @param [in] sectors Number of sectors to read
+ * @param [in] address Linear address of the destination
+ * @return true on success
+ * @return false on failure
+ */
+bool __check_ret
+bios_read_drive_linear(qword_t lba, dword_t sectors, dword_t address);
+
+/**
+ * @brief Find the largest transfer accepted by BIOS int 13h
+ * @details Tries to read 1024, 512, 256, 128, 127, 64 and less sectors, and
+ * caches the first transfer size which succeeds. Transfers above 128 sectors
+ * are probed only with EDD 3.0 flat buffer addressing
+ *
+ * @param [in] scratch Linear address of at least 512KB of scratch memory above
+ * 1MB
+ * @return true on success
+ * @return false if no transfer size works
+ */
+bool             bios_probe_max_transfer(dword_t scratch);
+
+/**
+ * @brief Get the largest number of sectors read by single BIOS call
+ *
+ * @return Number of sectors
+ */
+word_t           bios_max_transfer(void);
+
 /**
  * @brief Get drive parameteres, using BIOS int 13h
  *
@@ -138,19 +239,4 @@ bool __check_ret bios_get_drive_parameteres(drive_parameteres* buffer);
  */
 bool __check_ret bios_get_e820(dword_t* offset, dword_t buf_size, void* buffer);
 
-/**
- * @brief Initialize COM port, using BIOS int 14h
- *
- * @return true on success
- * @return false on failure
- */
-bool             bios_serial_init(void);
-
-/**
- * @brief Print character to COM port, using BIOS int 14h
- *
- * @param [in] ch ASCII character to print
- */
-void             bios_serial_putch(byte_t ch);
-
 #endif /* BL_BIOS_H */
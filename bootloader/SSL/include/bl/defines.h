@@ -9,8 +9,24 @@
 #define __align(n)           __attribute__((aligned(n)))
 
 #define SECTOR_SIZE          512
+#define PAGE_SIZE            4096
 
 #define TSL_ADDR             0x20000
 #define TSL_SEG              TSL_ADDR >> 4
 
+#define IMAGE_MAGIC          0x474D4956 /* "VIMG" */
+#define IMAGE_HEADER_OFFSET  5
+
+#define BOUNCE_ADDR          0x30000
+#define BOUNCE_SEG           (BOUNCE_ADDR >> 4)
+#define BOUNCE_SECTORS       128
+
+#define BOOT_LOG_ADDR        0x40000
+#define BOOT_LOG_SEG         (BOOT_LOG_ADDR >> 4)
+#define BOOT_LOG_SIZE        0x8000
+#define BOOT_LOG_MAGIC       0x474F4C56
+
+#define SERIAL_PORT          0x3F8
+#define SERIAL_BAUD          115200
+
 #endif /* BL_DEFINES_H */
@@ -0,0 +1,47 @@
+/**
+ * @file serial.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief 16550 UART driver
+ *
+ */
+#ifndef BL_SERIAL_H
+#define BL_SERIAL_H
+
+#include "types.h"
+
+/**
+ * @brief Initialize COM port
+ * @details Programs \ref SERIAL_PORT "COM port" for 8N1 with given divisor of
+ * 115200 baud and enables 16 byte FIFOs if UART has them
+ *
+ * @param [in] divisor Baud rate divisor
+ * @return true on success
+ * @return false if there is no UART
+ */
+bool serial_init(word_t divisor);
+
+/**
+ * @brief Queue character for COM port
+ * @details Characters are sent in bursts, which fill TX FIFO, when it is full
+ * or on \ref serial_flush
+ *
+ * @param [in] ch ASCII character to print
+ */
+void serial_putch(byte_t ch);
+
+/**
+ * @brief Send queued characters to COM port
+ *
+ */
+void serial_flush(void);
+
+/**
+ * @brief Write buffer to COM port
+ * @details Fills the whole TX FIFO each time it is empty
+ *
+ * @param [in] buf Pointer to the buffer
+ * @param [in] len Length of the buffer
+ */
+void serial_write(char const* buf, size_t len);
+
+#endif /* BL_SERIAL_H */
@@ -47,4 +47,24 @@ void*              memcpy(void* dest, void const* src, size_t count);
  */
 void*              memset(void* ptr, int val, size_t count);
 
+/**
+ * @brief Copies memory between linear addresses
+ * @details Runs with zero based DS and ES, so it works in Unreal mode only
+ *
+ * @param [in] dest Linear address to copy to
+ * @param [in] src Linear address to copy from
+ * @param [in] count Number of bytes to copy
+ */
+void               memcpy_linear(dword_t dest, dword_t src, dword_t count);
+
+/**
+ * @brief Fills memory at linear address with a character
+ * @details Runs with zero based DS and ES, so it works in Unreal mode only
+ *
+ * @param [in] dest Linear address to fill
+ * @param [in] val Fill byte
+ * @param [in] count Number of bytes to fill
+ */
+void               memset_linear(dword_t dest, byte_t val, dword_t count);
+
 #endif /* BL_STRING_H */
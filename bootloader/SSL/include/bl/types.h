@@ -443,6 +443,104 @@ enum {
 #define BOOT_VIDEO_LINTEXT BOOT_VIDEO_LINTEXT
 };
 
+/**
+ * @struct boot_log_t
+ * @brief Boot log ring buffer header
+ * @details Followed by \ref boot_log_t::size "size" bytes of log text. Until
+ * the log wraps, the oldest byte is the first one, after that the oldest byte
+ * is at \ref boot_log_t::written "written" % \ref boot_log_t::size "size"
+ *
+ * @typedef boot_log_t
+ * @brief boot_log_t type
+ *
+ */
+typedef struct __packed boot_log_t {
+  /**
+   * @brief Must be \ref BOOT_LOG_MAGIC
+   *
+   */
+  dword_t magic;
+  /**
+   * @brief Size of log text area
+   *
+   */
+  dword_t size;
+  /**
+   * @brief Total count of bytes ever written to the log
+   *
+   */
+  dword_t written;
+  /**
+   * @brief Reserved. Always 0
+   *
+   */
+  dword_t rsv;
+} boot_log_t;
+
+/**
+ * @struct module_info_t
+ * @brief Loaded module record
+ * @details Records are stored in load order, kernel image is the first one
+ *
+ * @typedef module_info_t
+ * @brief module_info_t type
+ *
+ */
+typedef struct __packed module_info_t {
+  /**
+   * @brief FNV-1a hash of module name
+   *
+   */
+  dword_t hash;
+  /**
+   * @brief Offset of NUL-terminated module name in
+   * \ref boot_info_t::modules "module names"
+   *
+   */
+  dword_t name;
+  /**
+   * @brief Physical address of loaded image
+   *
+   */
+  qword_t address;
+  /**
+   * @brief Physical address of entry point
+   *
+   */
+  qword_t entry;
+  /**
+   * @brief Size of loaded image
+   *
+   */
+  dword_t image_size;
+  /**
+   * @brief Size of stack, requested by image
+   *
+   */
+  dword_t stack_size;
+} module_info_t;
+
+/**
+ * @struct memory_range_t
+ * @brief Physical memory range
+ *
+ * @typedef memory_range_t
+ * @brief memory_range_t type
+ *
+ */
+typedef struct __packed memory_range_t {
+  /**
+   * @brief Physical address of range
+   *
+   */
+  qword_t address;
+  /**
+   * @brief Size of range
+   *
+   */
+  qword_t size;
+} memory_range_t;
+
 /**
  * @struct boot_info_t
  * @brief Boot info, passed to TSL and kernel
@@ -531,7 +629,133 @@ typedef struct __packed boot_info_t {
      *
      */
     qword_t address;
+    /**
+     * @brief Size of RAMFS archive, including end-of-archive blocks
+     *
+     */
+    qword_t size;
   } RAMFS;
+
+  /**
+   * @brief Boot log info
+   *
+   */
+  struct {
+    /**
+     * @brief Physical address of \ref boot_log_t "boot log"
+     *
+     */
+    qword_t address;
+    /**
+     * @brief Size of boot log, including header
+     *
+     */
+    dword_t size;
+  } boot_log;
+
+  /**
+   * @brief Physical page allocator state
+   *
+   */
+  struct {
+    /**
+     * @brief Physical address of page bitmap, set bit means used page
+     *
+     */
+    qword_t bitmap;
+    /**
+     * @brief Count of pages, covered by bitmap, starting from address 0
+     *
+     */
+    qword_t pages;
+    /**
+     * @brief Count of free pages
+     *
+     */
+    qword_t free_pages;
+  } pmm;
+
+  /**
+   * @brief Loaded modules info
+   *
+   */
+  struct {
+    /**
+     * @brief Physical address of \ref module_info_t "module records" array
+     *
+     */
+    qword_t address;
+    /**
+     * @brief Count of module records
+     *
+     */
+    dword_t count;
+    /**
+     * @brief Size of each module record
+     *
+     */
+    dword_t entry_size;
+    /**
+     * @brief Physical address of module names
+     *
+     */
+    qword_t names;
+    /**
+     * @brief Size of module names
+     *
+     */
+    dword_t names_size;
+  } modules;
+
+  /**
+   * @brief Module memory, which must be zeroed by kernel
+   * @details Loader may leave large BSS regions of loaded modules for kernel
+   * to zero. Kernel must clear them before touching its own BSS
+   *
+   */
+  struct {
+    /**
+     * @brief Physical address of \ref memory_range_t "memory range" array
+     *
+     */
+    qword_t address;
+    /**
+     * @brief Count of memory ranges
+     *
+     */
+    dword_t count;
+    /**
+     * @brief Size of each memory range entry
+     *
+     */
+    dword_t entry_size;
+  } zero_ranges;
+
+  /**
+   * @brief Page tables, built by TSL
+   * @details All RAM from the memory map and the first megabyte, except the
+   * first page, are identity mapped and mapped again from direct_map, with
+   * the largest pages that fit. Both maps share the same PDPT, PD and PT
+   * tables
+   *
+   */
+  struct {
+    /**
+     * @brief Physical address of PML4, the first of all page tables
+     *
+     */
+    qword_t pml4;
+    /**
+     * @brief Virtual address, at which physical address 0 is direct mapped
+     *
+     */
+    qword_t direct_map;
+    /**
+     * @brief Count of physically contiguous pages, taken by page tables
+     *
+     */
+    dword_t pages;
+  } paging;
 } boot_info_t;
 
 #endif /* BL_TYPES_H */
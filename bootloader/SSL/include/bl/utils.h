@@ -16,6 +16,57 @@
  */
 word_t               get_ds(void);
 
+/**
+ * @brief Convert DS relative pointer to linear address
+ *
+ * @param [in] ptr Pointer
+ * @return Linear address
+ */
+dword_t              linear_address(void const* ptr);
+
+/**
+ * @brief Convert linear address to DS relative pointer
+ * @details Pointers past the first 64KB of DS are valid in Unreal mode only
+ *
+ * @param [in] address Linear address, must not be below DS base
+ * @return Pointer
+ */
+void*                linear_pointer(dword_t address);
+
+/**
+ * @brief Read byte from the port
+ *
+ * @param [in] port Port number
+ * @return The byte
+ */
+byte_t               inb(word_t port);
+
+/**
+ * @brief Send byte to the port
+ *
+ * @param [in] port Port number
+ * @param [in] val Byte
+ */
+void                 outb(word_t port, byte_t val);
+
+/**
+ * @brief Build CRC32 tables
+ * @details Must be called before any other CRC32 function
+ *
+ */
+void                 crc32_init(void);
+
+/**
+ * @brief Continue CRC32 checksum with more data
+ * @details Uses slicing-by-8, so data is processed 8 bytes per step
+ *
+ * @param [in] crc CRC32 checksum of preceding data, 0 for none
+ * @param [in] buf Pointer to a buffer to be examined
+ * @param [in] len Length of the buffer
+ * @return CRC32 checksum of preceding data and the buffer
+ */
+uint32_t __check_ret crc32_update(uint32_t crc, byte_t const* buf, size_t len);
+
 /**
  * @brief Calculate CRC32 checksum
  *
@@ -76,6 +127,7 @@ void enter_unreal(word_t data_segment_offset);
 
 /**
  * @brief Get the partition array object
+ * @details Partition array is checked against its CRC32 from GPT header
  *
  * @param [in] gpt_hdr Pointer to the \ref GPT_header "GPT header" object
  * @return  Pointer to the \ref GPT_partition_array "GPT Partition array"
@@ -83,6 +135,18 @@ void enter_unreal(word_t data_segment_offset);
  */
 GPT_partition_array* __check_ret get_partition_array(GPT_header const* gpt_hdr);
 
+/**
+ * @brief Verify checksum of loaded image
+ * @details Image starts with a jump, followed by \ref IMAGE_MAGIC, image size
+ * and CRC32 of the image, calculated with CRC32 field being zero. The field
+ * is filled by crcpatch after linking
+ *
+ * @param [in] address Linear address of the image
+ * @param [in] max_size Size of memory the image was loaded to
+ * @return true if image is intact
+ */
+bool __check_ret verify_image(dword_t address, dword_t max_size);
+
 /**
  * @brief Find partition by GUID
  *
@@ -96,14 +160,19 @@ GPT_partition_entry*
 find_partition(GPT_partition_array const* partition_array, byte_t const* GUID);
 
 /**
- * @brief Loads kernel partition from drive
+ * @brief Loads RAMFS from kernel partition
+ * @details Streams the ustar archive and stops reading the drive at the
+ * end-of-archive marker (two zero blocks), so only the payload is loaded
  *
- * @param partition Kernel partition
- * @param address Where to load kernel
+ * @param [in] partition Kernel partition
+ * @param [in] address Where to load RAMFS
+ * @param [out] size Size of the loaded archive
  * @return true on success
  * @return false on failure
  */
-bool         load_kernel(GPT_partition_entry const* partition, dword_t address);
+bool load_kernel(
+    GPT_partition_entry const* partition, dword_t address, dword_t* size
+);
 
 /**
  * @brief Create a boot info object
@@ -111,10 +180,14 @@ bool         load_kernel(GPT_partition_entry const* partition, dword_t address);
  * @param drive_GUID GUID of the booted drive
  * @param mem_map Memory map, returned by \ref get_memory_map
  * @param ramfs_addr Physical address of RAMFS
+ * @param ramfs_size Size of RAMFS
  * @return Boot info object
  */
 boot_info_t* create_boot_info(
-    byte_t const* drive_GUID, memory_map* mem_map, qword_t ramfs_addr
+    byte_t const* drive_GUID,
+    memory_map*   mem_map,
+    qword_t       ramfs_addr,
+    qword_t       ramfs_size
 );
 
 /**
@@ -5,6 +5,8 @@
  *
  */
 #include <bl/bios.h>
+#include <bl/string.h>
+#include <bl/utils.h>
 
 /* Leave this undocument */
 #ifndef DOX_SKIP
@@ -12,21 +14,26 @@
 /* From bootstrap.asm */
 extern byte_t _drive_number;
 
-#endif /* DOX_SKIP */
+/* Disk reading info. Lives in .data, because .bss isn't cleared */
+static struct {
+  bool   flat_reads;
+  word_t max_sectors;
+} _disk_ctx = { false, 127 };
 
-bool bios_serial_init(void) {
-  bool ret;
-  __asm__ volatile("int $0x14"
-                   : "=@ccc"(ret)
-                   : "a"((word_t)0x00E3), "d"((word_t)0x0000));
-  return !ret;
-}
+/* int 13h AH=41h: Extended disk access functions are supported */
+#  define EDD_FEATURE_DAP   0x0001
 
-void bios_serial_putch(byte_t ch) {
-  __asm__ volatile("int $0x14"
-                   :
-                   : "a"((word_t)0x0100 | (word_t)ch), "d"((word_t)0x0000));
-}
+/* int 13h AH=48h: Size of EDD 3.0 result buffer */
+#  define EDD30_PARAMS_SIZE 0x42
+
+/* Attempts to read a chunk before it is splitted */
+#  define DISK_RETRIES      3
+
+/* Transfer sizes probed at boot, largest first */
+static word_t const _probe_sectors[] = { 1024, 512, 256, 128, 127, 64,
+                                         32,   16,  8,   4,   2,   1 };
+
+#endif /* DOX_SKIP */
 
 void bios_putch(byte_t ch) {
   __asm__ volatile("int $0x10"
@@ -60,33 +67,204 @@ bool bios_get_drive_parameteres(drive_parameteres* buffer) {
   return !ret;
 }
 
-bool bios_read_drive(const DAP* read_context) {
-  bool ret;
+/* Leave this undocument */
+#ifndef DOX_SKIP
+
+/* Reset disk system */
+static void _reset_drive(void) {
+  __asm__ volatile("int $0x13"
+                   :
+                   : "a"((word_t)0x0000), "d"(_drive_number)
+                   : "cc");
+}
+
+/* Issue single read. Fails if BIOS transferred less than requested */
+static bool
+_read_once(qword_t lba, word_t sectors, dword_t address, bool flat) {
+  DAP64 read_context;
+  bool  ret;
+
+  read_context.size    = flat ? sizeof(DAP64) : sizeof(DAP);
+  read_context.rsv     = 0;
+  read_context.sectors = sectors;
+  read_context.lba     = lba;
+  if (flat) {
+    read_context.offset       = 0xFFFF;
+    read_context.segment      = 0xFFFF;
+    read_context.flat_address = address;
+  } else {
+    read_context.offset       = (word_t)(address & 0xF);
+    read_context.segment      = (word_t)(address >> 4);
+    read_context.flat_address = 0;
+  }
+
   __asm__ volatile("int $0x13"
                    : "=@ccc"(ret)
                    : "a"((word_t)0x4200),
                      "d"(_drive_number),
-                     "S"((word_t)((uintptr_t)read_context & 0xFFFF)));
+                     "S"((word_t)((uintptr_t)&read_context & 0xFFFF))
+                   : "memory");
+  return !ret && read_context.sectors == sectors;
+}
 
-  /* Some BIOSes can't read more than 127 sectors */
-  if (ret && read_context->sectors == 128) {
-    DAP tmp_read_context;
-    tmp_read_context         = *read_context;
+/* Read drive below 1MB in the largest chunks BIOS accepts */
+static bool _read_chunked(qword_t lba, dword_t sectors, dword_t address) {
+  while (sectors != 0) {
+    word_t chunk, seg_limit;
+    size_t attempt;
+    bool   split;
 
-    /* Read first 127 sectors */
-    tmp_read_context.sectors = 127;
-    if (!bios_read_drive(&tmp_read_context)) {
-      return false;
+    /* Chunk must fit in one real mode segment */
+    chunk     = _disk_ctx.max_sectors;
+    seg_limit = (word_t)((0x10000 - (address & 0xF)) / SECTOR_SIZE);
+    if (chunk > seg_limit) {
+      chunk = seg_limit;
+    }
+    if (chunk > sectors) {
+      chunk = (word_t)sectors;
     }
 
-    /* Read last sector */
-    tmp_read_context.sectors  = 1;
-    tmp_read_context.offset  += 127 * SECTOR_SIZE;
-    if (!bios_read_drive(&tmp_read_context)) {
-      return false;
-    } else {
+    /* Retry after drive reset, then split the chunk */
+    attempt = 0;
+    split   = false;
+    while (!_read_once(lba, chunk, address, false)) {
+      _reset_drive();
+      if (++attempt < DISK_RETRIES) {
+        continue;
+      }
+      if (chunk == 1) {
+        return false;
+      }
+      chunk   /= 2;
+      attempt  = 0;
+      split    = true;
+    }
+
+    /* Remember transfer size which works */
+    if (split) {
+      _disk_ctx.max_sectors = chunk;
+    }
+
+    lba     += chunk;
+    address += (dword_t)chunk * SECTOR_SIZE;
+    sectors -= chunk;
+  }
+  return true;
+}
+
+#endif /* DOX_SKIP */
+
+bool bios_detect_flat_reads(dword_t scratch) {
+  word_t  bx, cx, version;
+  bool    ret;
+  byte_t  params[EDD30_PARAMS_SIZE];
+  byte_t* probe;
+
+  _disk_ctx.flat_reads = false;
+
+  /* Check EDD version */
+  __asm__ volatile("int $0x13"
+                   : "=@ccc"(ret), "=a"(version), "=b"(bx), "=c"(cx)
+                   : "a"((word_t)0x4100),
+                     "b"((word_t)0x55AA),
+                     "d"(_drive_number));
+  if (ret || bx != 0xAA55 || (version >> 8) < 0x30 ||
+      !(cx & EDD_FEATURE_DAP)) {
+    return false;
+  }
+
+  /* EDD 3.0 BIOS returns extended drive parameteres */
+  memset(params, 0, sizeof params);
+  *(word_t*)&params[0] = sizeof params;
+  __asm__ volatile("int $0x13"
+                   : "=@ccc"(ret)
+                   : "a"((word_t)0x4800),
+                     "d"(_drive_number),
+                     "S"((word_t)((uintptr_t)params & 0xFFFF))
+                   : "memory");
+  if (ret || *(word_t*)&params[0] < 0x1E) {
+    return false;
+  }
+
+  /* Make sure BIOS really writes to flat address: GPT header is always located
+   * at LBA 1 */
+  probe = (byte_t*)(scratch - ((dword_t)get_ds() << 4));
+  memset(probe, 0, 8);
+  if (!_read_once(1, 1, scratch, true) ||
+      memcmp(probe, "EFI PART", 8) != 0) {
+    _reset_drive();
+    return false;
+  }
+
+  _disk_ctx.flat_reads = true;
+  return true;
+}
+
+bool bios_probe_max_transfer(dword_t scratch) {
+  size_t i;
+
+  for (i = 0; i < sizeof _probe_sectors / sizeof _probe_sectors[0]; ++i) {
+    word_t  sectors = _probe_sectors[i];
+    dword_t address = _disk_ctx.flat_reads ? scratch : BOUNCE_ADDR;
+
+    /* Bounce buffer holds 128 sectors */
+    if (!_disk_ctx.flat_reads && sectors > BOUNCE_SECTORS) {
+      continue;
+    }
+
+    if (_read_once(0, sectors, address, _disk_ctx.flat_reads)) {
+      _disk_ctx.max_sectors = sectors;
       return true;
     }
+    _reset_drive();
   }
-  return !ret;
+  return false;
+}
+
+word_t bios_max_transfer(void) {
+  if (!_disk_ctx.flat_reads && _disk_ctx.max_sectors > BOUNCE_SECTORS) {
+    return BOUNCE_SECTORS;
+  }
+  return _disk_ctx.max_sectors;
+}
+
+bool bios_read_drive(const DAP* read_context) {
+  return _read_chunked(
+      read_context->lba,
+      read_context->sectors,
+      ((dword_t)read_context->segment << 4) + read_context->offset
+  );
+}
+
+bool bios_read_drive_linear(qword_t lba, dword_t sectors, dword_t address) {
+  while (sectors != 0) {
+    word_t count;
+
+    if (_disk_ctx.flat_reads) {
+      count = sectors < _disk_ctx.max_sectors ? (word_t)sectors
+                                              : _disk_ctx.max_sectors;
+      if (_read_once(lba, count, address, true)) {
+        lba     += count;
+        address += (dword_t)count * SECTOR_SIZE;
+        sectors -= count;
+        continue;
+      }
+
+      /* Don't try flat reads anymore */
+      _reset_drive();
+      _disk_ctx.flat_reads = false;
+    }
+
+    /* Read through the bounce buffer */
+    count = sectors < BOUNCE_SECTORS ? (word_t)sectors : BOUNCE_SECTORS;
+    if (!_read_chunked(lba, count, BOUNCE_ADDR)) {
+      return false;
+    }
+    memcpy_linear(address, BOUNCE_ADDR, (dword_t)count * SECTOR_SIZE);
+
+    lba     += count;
+    address += (dword_t)count * SECTOR_SIZE;
+    sectors -= count;
+  }
+  return true;
 }
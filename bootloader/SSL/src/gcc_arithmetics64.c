@@ -31,8 +31,8 @@ typedef union gcc64 {
    *
    */
   struct {
-    uint32_t hi;
     uint32_t lo;
+    uint32_t hi;
   } u32;
 
   /**
@@ -40,13 +40,43 @@ typedef union gcc64 {
    *
    */
   struct {
-    int32_t hi;
     int32_t lo;
+    int32_t hi;
   } s32;
 } gcc64;
 
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Divide hi:lo by divisor with single hardware division, hi must be less
+ * than divisor */
+static uint32_t
+_divl(uint32_t hi, uint32_t lo, uint32_t divisor, uint32_t* remainder) {
+  uint32_t quotient;
+  __asm__("divl %[divisor]"
+          : "=a"(quotient), "=d"(*remainder)
+          : "a"(lo), "d"(hi), [divisor] "rm"(divisor));
+  return quotient;
+}
+
+/* Number of leading zero bits of non-zero value */
+static uint32_t _clz(uint32_t value) {
+  uint32_t index;
+  __asm__("bsrl %[value], %[index]"
+          : [index] "=r"(index)
+          : [value] "rm"(value));
+  return 31 - index;
+}
+
+#endif /* DOX_SKIP */
+
 /**
  * @brief Divide unsigned 64bit divdend by unsigned 64bit divisor
+ * @details Divisors, which fit in 32 bits, take two chained hardware
+ * divisions. Wider divisors are normalized, so the quotient is estimated
+ * with one hardware division and corrected at most once (Knuth's
+ * algorithm D for two-digit divisor). Division by zero causes divide
+ * exception
  *
  * @param [in] dividend The dividend
  * @param [in] divisor The divisor
@@ -56,30 +86,37 @@ typedef union gcc64 {
 void unsigned_division64(
     qword_t dividend, qword_t divisor, qword_t* quotient, qword_t* remainder
 ) {
-  /* Based on "Long division" algorithm
-   * https://en.wikipedia.org/wiki/Division_algorithm#Integer_division_(unsigned)_with_remainder
-   */
-
-  int   i;
-  gcc64 N, D, Q, R;
+  gcc64    N, D, Q, R;
+  uint32_t shift;
   N.u64 = dividend;
   D.u64 = divisor;
 
-  /* If divisor is zero cause divide exception */
-  if (D.u64 == 0) {
-    __asm__ volatile("div %[reg]"
-                     :
-                     : [reg] "r"(0));
-  }
-  Q.u64 = 0;
-  R.u64 = 0;
-  for (i = 64 - 1; i >= 0; --i) {
-    R.u64  = R.u64 << 1;
-    /* Set the least-significant bit of R equal to bit i of the numerator */
-    R.u64 |= !!(N.u64 & (1ULL << i));
+  if (D.u32.hi == 0) {
+    /* Divide high half first, its remainder is less than divisor, so the
+     * second division can't overflow. Zero divisor faults here */
+    R.u32.hi = 0;
+    Q.u32.hi = _divl(0, N.u32.hi, D.u32.lo, &R.u32.lo);
+    Q.u32.lo = _divl(R.u32.lo, N.u32.lo, D.u32.lo, &R.u32.lo);
+  } else {
+    /* Quotient fits in 32 bits. Normalize divisor, so its high half has
+     * the top bit set, and estimate quotient from dividend shifted right by
+     * one to keep the hardware division from overflow */
+    shift    = _clz(D.u32.hi);
+    R.u64    = N.u64 >> 1;
+    Q.u32.hi = 0;
+    Q.u32.lo = _divl(
+        R.u32.hi, R.u32.lo, (uint32_t)((D.u64 << shift) >> 32), &R.u32.lo
+    );
+
+    /* Undo normalization, estimate is now correct or one too large */
+    Q.u32.lo = (uint32_t)(((uint64_t)Q.u32.lo << shift) >> 31);
+    if (Q.u32.lo != 0) {
+      --Q.u32.lo;
+    }
+    R.u64 = N.u64 - Q.u64 * D.u64;
     if (R.u64 >= D.u64) {
-      R.u64  = R.u64 - D.u64;
-      Q.u64 |= 1ULL << i;
+      ++Q.u32.lo;
+      R.u64 -= D.u64;
     }
   }
 
@@ -104,3 +141,29 @@ qword_t __udivmoddi4(qword_t a, qword_t b, qword_t* c) {
   unsigned_division64(a, b, &ret, c);
   return ret;
 }
+
+/**
+ * @brief GCC interface for 64bit unsigned division
+ *
+ * @param [in] a The dividend
+ * @param [in] b The divisor
+ * @return Quotient
+ */
+qword_t __udivdi3(qword_t a, qword_t b) {
+  qword_t ret;
+  unsigned_division64(a, b, &ret, NULL);
+  return ret;
+}
+
+/**
+ * @brief GCC interface for 64bit unsigned remainder
+ *
+ * @param [in] a The dividend
+ * @param [in] b The divisor
+ * @return Remainder
+ */
+qword_t __umoddi3(qword_t a, qword_t b) {
+  qword_t ret;
+  unsigned_division64(a, b, NULL, &ret);
+  return ret;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file log.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Boot log ring buffer
+ *
+ */
+#include <bl/log.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Log writer state */
+static struct {
+  word_t  pos;
+  dword_t written;
+} _log_ctx;
+
+/* Boot log is accessed through ES, so it works before Unreal mode */
+static void _store_dword(word_t offset, dword_t val) {
+  __asm__ volatile(
+      "pushw %%es\n"
+      "movw %[seg], %%es\n"
+      "movl %[val], %%es:(%%di)\n"
+      "popw %%es"
+      :
+      : [seg] "r"((word_t)BOOT_LOG_SEG), [val] "r"(val), "D"(offset)
+      : "memory"
+  );
+}
+
+static void _store_span(word_t offset, char const* span, word_t len) {
+  __asm__ volatile(
+      "pushw %%es\n"
+      "movw %[seg], %%es\n"
+      "cld\n"
+      "rep movsb\n"
+      "popw %%es"
+      : "+S"(span), "+D"(offset), "+c"(len)
+      : [seg] "r"((word_t)BOOT_LOG_SEG)
+      : "memory"
+  );
+}
+
+#endif /* DOX_SKIP */
+
+void log_init(void) {
+  _log_ctx.pos     = 0;
+  _log_ctx.written = 0;
+
+  _store_dword(offsetof(boot_log_t, magic), BOOT_LOG_MAGIC);
+  _store_dword(offsetof(boot_log_t, size), BOOT_LOG_SIZE);
+  _store_dword(offsetof(boot_log_t, written), 0);
+  _store_dword(offsetof(boot_log_t, rsv), 0);
+}
+
+void log_write(char const* span, size_t len) {
+  while (len != 0) {
+    /* Copy up to the end of ring buffer */
+    word_t run = BOOT_LOG_SIZE - _log_ctx.pos;
+    if (run > len) {
+      run = (word_t)len;
+    }
+
+    _store_span(sizeof(boot_log_t) + _log_ctx.pos, span, run);
+    span             += run;
+    len              -= run;
+    _log_ctx.written += run;
+    if ((_log_ctx.pos += run) == BOOT_LOG_SIZE) {
+      _log_ctx.pos = 0;
+    }
+  }
+}
+
+void log_commit(void) {
+  _store_dword(offsetof(boot_log_t, written), _log_ctx.written);
+}
@@ -6,6 +6,7 @@
  */
 #include <bl/bios.h>
 #include <bl/io.h>
+#include <bl/log.h>
 #include <bl/mem.h>
 #include <bl/string.h>
 #include <bl/utils.h>
@@ -17,11 +18,9 @@
 extern char   _heap;
 extern word_t _heap_size;
 
-/* Allocator info */
-static struct {
-  void*  start;
-  size_t max_alloc;
-} _mem_ctx;
+/* Number of segregated free lists, class N holds blocks of
+ * [16 << N, 32 << N) bytes, the last one holds everything bigger */
+#  define SIZE_CLASSES 16
 
 /* Block header */
 typedef struct __align(16) _block_hdr {
@@ -33,8 +32,109 @@ typedef struct __align(16) _block_hdr {
 
 _block_hdr;
 
+/* Free list links, stored in the data of a free block */
+typedef struct {
+  _block_hdr* next;
+  _block_hdr* prev;
+} _free_links;
+
+/* Allocator info */
+static struct {
+  void*       start;
+  size_t      max_alloc;
+  dword_t     classes;
+  _block_hdr* lists[SIZE_CLASSES];
+} _mem_ctx;
+
 static size_t __inline__ _align16(size_t val) { return (val + 15) & -16; }
 
+static _free_links* _links(_block_hdr* block) {
+  return (_free_links*)((byte_t*)block + sizeof(_block_hdr));
+}
+
+/* Index of the highest set bit of non-zero value */
+static dword_t _bsr(dword_t val) {
+  dword_t index;
+  __asm__("bsrl %[val], %[index]"
+          : [index] "=r"(index)
+          : [val] "rm"(val));
+  return index;
+}
+
+/* Index of the lowest set bit of non-zero value */
+static dword_t _bsf(dword_t val) {
+  dword_t index;
+  __asm__("bsfl %[val], %[index]"
+          : [index] "=r"(index)
+          : [val] "rm"(val));
+  return index;
+}
+
+/* Size class, which holds blocks of given size */
+static dword_t _size_class(size_t size) {
+  dword_t class = _bsr(size >> 4);
+  return class < SIZE_CLASSES ? class : SIZE_CLASSES - 1;
+}
+
+/* Recalculate biggest free block, only the highest class is scanned */
+static void _find_max_block(void) {
+  _block_hdr* block;
+
+  _mem_ctx.max_alloc = 0;
+  if (_mem_ctx.classes == 0) {
+    return;
+  }
+
+  for (block = _mem_ctx.lists[_bsr(_mem_ctx.classes)]; block != NULL;
+       block = _links(block)->next) {
+    if (block->size > _mem_ctx.max_alloc) {
+      _mem_ctx.max_alloc = block->size;
+    }
+  }
+}
+
+/* Put block to free list of its class */
+static void _insert_free(_block_hdr* block) {
+  dword_t      class = _size_class(block->size);
+  _free_links* links = _links(block);
+
+  block->free        = true;
+  links->prev        = NULL;
+  links->next        = _mem_ctx.lists[class];
+  if (links->next != NULL) {
+    _links(links->next)->prev = block;
+  }
+  _mem_ctx.lists[class]  = block;
+  _mem_ctx.classes      |= 1UL << class;
+
+  if (block->size > _mem_ctx.max_alloc) {
+    _mem_ctx.max_alloc = block->size;
+  }
+}
+
+/* Take block from free list of its class */
+static void _remove_free(_block_hdr* block) {
+  dword_t      class = _size_class(block->size);
+  _free_links* links = _links(block);
+
+  block->free        = false;
+  if (links->prev != NULL) {
+    _links(links->prev)->next = links->next;
+  } else {
+    _mem_ctx.lists[class] = links->next;
+    if (links->next == NULL) {
+      _mem_ctx.classes &= ~(1UL << class);
+    }
+  }
+  if (links->next != NULL) {
+    _links(links->next)->prev = links->prev;
+  }
+
+  if (block->size == _mem_ctx.max_alloc) {
+    _find_max_block();
+  }
+}
+
 static void _allocate_block(_block_hdr* after, size_t size) {
   _block_hdr* new_block =
       (_block_hdr*)((byte_t*)after + after->size + sizeof(_block_hdr));
@@ -50,18 +150,6 @@ static void _allocate_block(_block_hdr* after, size_t size) {
   }
 }
 
-static void _find_max_block(void) {
-  _block_hdr* block;
-
-  _mem_ctx.max_alloc = 0;
-  for (block = (_block_hdr*)_mem_ctx.start; block != NULL;
-       block = block->next) {
-    if (block->size > _mem_ctx.max_alloc) {
-      _mem_ctx.max_alloc = block->size;
-    }
-  }
-}
-
 static _block_hdr* _merge_blocks(_block_hdr* up, _block_hdr* down) {
   _block_hdr* next  = down->next;
 
@@ -75,95 +163,112 @@ static _block_hdr* _merge_blocks(_block_hdr* up, _block_hdr* down) {
   return up;
 }
 
+/* Cut used block down to size and free the tail */
+static void _trim_block(_block_hdr* block, size_t size) {
+  size_t      block_left = block->size - size;
+  _block_hdr* tail;
+
+  if (block_left < sizeof(_block_hdr) + 16) {
+    /* Tail is too small for a block */
+    return;
+  }
+
+  block->size = size;
+  _allocate_block(block, block_left - sizeof(_block_hdr));
+
+  /* Try to merge new block with it's next block */
+  tail = block->next;
+  if (tail->next != NULL && tail->next->free) {
+    _remove_free(tail->next);
+    _merge_blocks(tail, tail->next);
+  }
+  _insert_free(tail);
+}
+
 #endif /* DOX_SKIP */
 
 bool mem_init(void) {
   _block_hdr* initial_block;
+  int         i;
 
   _mem_ctx.start      = (void*)_align16((size_t)&_heap);
+  _mem_ctx.max_alloc  = 0;
+  _mem_ctx.classes    = 0;
+  for (i = 0; i < SIZE_CLASSES; ++i) { _mem_ctx.lists[i] = NULL; }
 
   initial_block       = (_block_hdr*)_mem_ctx.start;
-  initial_block->free = true;
   initial_block->size = _heap_size -
                         ((ptrdiff_t)_mem_ctx.start - (ptrdiff_t)&_heap) -
                         sizeof(_block_hdr);
   initial_block->next = NULL;
   initial_block->prev = NULL;
-
-  _mem_ctx.max_alloc  = initial_block->size;
+  _insert_free(initial_block);
 
   return true;
 }
 
 void* malloc(size_t count) {
   _block_hdr* free_block;
-  bool        block_found;
-  size_t      block_left;
+  dword_t     class, candidates;
 
-  /* Align bytes count */
-  count = _align16(count);
+  /* Align bytes count, free block must hold free list links */
+  count = count != 0 ? _align16(count) : 16;
   if (count > _mem_ctx.max_alloc) {
     return NULL;
   }
 
-  /* Find suitable free block */
-  block_found = false;
-  for (free_block = (_block_hdr*)_mem_ctx.start; free_block != NULL;
-       free_block = free_block->next) {
-    if (free_block->free && free_block->size >= count) {
-      block_found = true;
-      break;
-    }
-  }
-  if (!block_found) {
-    return NULL;
+  /* Any block of the next classes fits, so does any block of the class
+   * itself if count is its lower bound, the last class is unbounded */
+  class      = _size_class(count);
+  candidates = _mem_ctx.classes & (~0UL << class);
+  if (class == SIZE_CLASSES - 1 || count != (size_t)16 << class) {
+    candidates &= ~(1UL << class);
   }
 
-  /* Try to allocate new free block */
-  block_left       = free_block->size - count;
-  free_block->free = false;
-  free_block->size = count;
-  if (block_left < sizeof(_block_hdr) + 16) {
-    free_block->size += block_left;
+  if (candidates != 0) {
+    free_block = _mem_ctx.lists[_bsf(candidates)];
   } else {
-    _allocate_block(free_block, block_left - sizeof(_block_hdr));
+    /* Search class of count for suitable block */
+    for (free_block = _mem_ctx.lists[class]; free_block != NULL;
+         free_block = _links(free_block)->next) {
+      if (free_block->size >= count) {
+        break;
+      }
+    }
+    if (free_block == NULL) {
+      return NULL;
+    }
   }
 
-  /* Find new max block */
-  _find_max_block();
+  /* Try to allocate new free block */
+  _remove_free(free_block);
+  _trim_block(free_block, count);
 
   return (byte_t*)free_block + sizeof(_block_hdr);
 }
 
 void* realloc(void* mem, size_t new_size) {
   _block_hdr* block = (_block_hdr*)((byte_t*)mem - sizeof(_block_hdr));
-  new_size          = _align16(new_size);
+  _block_hdr* next  = block->next;
+  new_size          = new_size != 0 ? _align16(new_size) : 16;
 
   if (block->size > new_size) {
     /* Decrease block size */
-    size_t block_left = block->size - new_size;
-    block->size       = new_size;
-    if (block_left < sizeof(_block_hdr) + 16) {
-      /* Cannot decrease block size */
-      block->size += block_left;
-      return mem;
-    } else {
-      /* Allocate new block from decreased size */
-      _allocate_block(block, block_left - sizeof(_block_hdr));
-
-      /* Try to merge new block with it's next block */
-      if (block->next->next && block->next->next->free) {
-        _merge_blocks(block->next, block->next->next);
-      }
+    _trim_block(block, new_size);
+    return mem;
+  } else if (block->size < new_size) {
+    void* new_mem;
 
-      /* Find new max block */
-      _find_max_block();
+    /* Grow in place, if next block is free and big enough */
+    if (next != NULL && next->free &&
+        block->size + sizeof(_block_hdr) + next->size >= new_size) {
+      _remove_free(next);
+      _merge_blocks(block, next);
+      _trim_block(block, new_size);
       return mem;
     }
 
-  } else if (block->size < new_size) {
     /* Allocate new memory */
-    void* new_mem;
     if ((new_mem = malloc(new_size)) == NULL) {
       /* Failed to allocate new memory */
       return NULL;
@@ -185,21 +290,18 @@ void* realloc(void* mem, size_t new_size) {
 void free(void* mem) {
   _block_hdr* block = (_block_hdr*)((byte_t*)mem - sizeof(_block_hdr));
 
-  /* Mark block as free*/
-  block->free       = true;
-
   /* Try to merge free blocks */
   if (block->prev != NULL && block->prev->free) {
+    _remove_free(block->prev);
     block = _merge_blocks(block->prev, block);
   }
   if (block->next != NULL && block->next->free) {
+    _remove_free(block->next);
     block = _merge_blocks(block, block->next);
   }
 
-  /* Update max alloc size */
-  if (block->size > _mem_ctx.max_alloc) {
-    _mem_ctx.max_alloc = block->size;
-  }
+  /* Put block to free list */
+  _insert_free(block);
 }
 
 memory_map* get_memory_map(void) {
@@ -260,19 +362,23 @@ void _dump_heap(void) {
   size_t      block_index = 0;
   _block_hdr* block;
 
-  serial_printf(
+  log_printf(
+      LOG_DEBUG,
       "HEAP DUMP:\n"
       "Start = %p\n"
       "Max alloc = %zu bytes\n"
+      "Size classes = %#lx\n"
       "Header size = %zu\n",
       _mem_ctx.start,
       _mem_ctx.max_alloc,
+      (unsigned long)_mem_ctx.classes,
       sizeof(_block_hdr)
   );
 
   for (block = (_block_hdr*)_mem_ctx.start; block != NULL;
        block = block->next) {
-    serial_printf(
+    log_printf(
+        LOG_DEBUG,
         "Block %zu:\n"
         "    Free = %d\n"
         "    Block address = %p\n"
@@ -294,7 +400,8 @@ void _dump_heap(void) {
 void _dump_memory_map(memory_map* mem_map) {
   memory_map_node* node = mem_map->list;
   while (node) {
-    serial_printf(
+    log_printf(
+        LOG_DEBUG,
         "Base address = %#.16llx, Limit = %#.16llx, Type = %d, ACPI = %d\n",
         node->entry.base,
         node->entry.limit,
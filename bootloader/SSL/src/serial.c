@@ -0,0 +1,110 @@
+/**
+ * @file serial.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief 16550 UART driver
+ *
+ */
+#include <bl/serial.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* UART registers */
+#  define UART_DATA      (SERIAL_PORT + 0)
+#  define UART_DLL       (SERIAL_PORT + 0)
+#  define UART_IER       (SERIAL_PORT + 1)
+#  define UART_DLM       (SERIAL_PORT + 1)
+#  define UART_FCR       (SERIAL_PORT + 2)
+#  define UART_IIR       (SERIAL_PORT + 2)
+#  define UART_LCR       (SERIAL_PORT + 3)
+#  define UART_MCR       (SERIAL_PORT + 4)
+#  define UART_LSR       (SERIAL_PORT + 5)
+
+/* Line control: 8 data bits, no parity, 1 stop bit */
+#  define LCR_8N1        0x03
+#  define LCR_DLAB       0x80
+
+/* FIFO control: enable, clear RX and TX, 14 byte RX trigger */
+#  define FCR_ENABLE     0xC7
+
+/* Modem control: DTR, RTS, OUT2 and loopback */
+#  define MCR_NORMAL     0x0B
+#  define MCR_LOOPBACK   0x1E
+
+/* Line status: TX holding register is empty */
+#  define LSR_THRE       0x20
+
+/* Interrupt identification: FIFOs are enabled */
+#  define IIR_FIFO       0xC0
+
+#  define UART_FIFO_SIZE 16
+
+/* Driver info. Lives in .data, because .bss isn't cleared */
+static struct {
+  bool   present;
+  size_t fifo_size;
+  size_t queued;
+  char   queue[UART_FIFO_SIZE];
+} _serial_ctx = { false, 1, 0, { 0 } };
+
+#endif /* DOX_SKIP */
+
+bool serial_init(word_t divisor) {
+  _serial_ctx.present   = false;
+  _serial_ctx.fifo_size = 1;
+  _serial_ctx.queued    = 0;
+
+  outb(UART_IER, 0x00); /* Disable interrupts */
+
+  outb(UART_LCR, LCR_DLAB); /* Set baud rate divisor */
+  outb(UART_DLL, (byte_t)(divisor & 0xFF));
+  outb(UART_DLM, (byte_t)(divisor >> 8));
+  outb(UART_LCR, LCR_8N1);
+
+  outb(UART_FCR, FCR_ENABLE);
+
+  /* Check UART in loopback mode */
+  outb(UART_MCR, MCR_LOOPBACK);
+  outb(UART_DATA, 0xAE);
+  if (inb(UART_DATA) != 0xAE) {
+    outb(UART_MCR, MCR_NORMAL);
+    return false;
+  }
+  outb(UART_MCR, MCR_NORMAL);
+
+  /* 8250 and 16450 have no FIFO */
+  if ((inb(UART_IIR) & IIR_FIFO) == IIR_FIFO) {
+    _serial_ctx.fifo_size = UART_FIFO_SIZE;
+  }
+
+  _serial_ctx.present = true;
+  return true;
+}
+
+void serial_write(char const* buf, size_t len) {
+  if (!_serial_ctx.present) {
+    return;
+  }
+
+  while (len != 0) {
+    size_t burst = len < _serial_ctx.fifo_size ? len : _serial_ctx.fifo_size;
+
+    /* Wait until TX FIFO drains and refill it */
+    while ((inb(UART_LSR) & LSR_THRE) == 0) { continue; }
+    len -= burst;
+    while (burst--) { outb(UART_DATA, (byte_t)*buf++); }
+  }
+}
+
+void serial_flush(void) {
+  serial_write(_serial_ctx.queue, _serial_ctx.queued);
+  _serial_ctx.queued = 0;
+}
+
+void serial_putch(byte_t ch) {
+  _serial_ctx.queue[_serial_ctx.queued++] = (char)ch;
+  if (_serial_ctx.queued == UART_FIFO_SIZE) {
+    serial_flush();
+  }
+}
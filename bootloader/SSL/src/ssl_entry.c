@@ -7,7 +7,10 @@
 #include <bl/bios.h>
 #include <bl/defines.h>
 #include <bl/io.h>
+#include <bl/log.h>
 #include <bl/mem.h>
+#include <bl/pmm.h>
+#include <bl/serial.h>
 #include <bl/string.h>
 #include <bl/types.h>
 #include <bl/utils.h>
@@ -35,8 +38,7 @@ static byte_t const tsl_partition_type[] = {
  * @param error_str Error message
  */
 static void print_error(char const* error_str) {
-  printf("VLGBL Error: %s\n", error_str);
-  serial_printf("VLGBL Error: %s\n", error_str);
+  log_printf(LOG_ERROR, "VLGBL Error: %s\n", error_str);
 }
 
 /**
@@ -64,6 +66,7 @@ void __noreturn ssl_entry(void) {
 
   GPT_partition_entry* tsl_partition;
   GPT_partition_entry* kernel_partition;
+  dword_t              ramfs_size;
 
   DAP                  read_context;
   drive_parameteres    drive_params;
@@ -71,11 +74,17 @@ void __noreturn ssl_entry(void) {
   read_context.size = sizeof(DAP);
   read_context.rsv  = 0;
 
+  /* Create boot log */
+  log_init();
+
   /* Print loading message */
-  (void)printf("Loading VLGBL...\n");
+  (void)log_printf(LOG_INFO, "Loading VLGBL...\n");
 
   /* Initialize COM port */
-  (void)bios_serial_init();
+  (void)serial_init(115200 / SERIAL_BAUD);
+
+  /* Build CRC32 tables */
+  crc32_init();
 
   /* Check CPUID presence */
   if (!check_cpuid()) {
@@ -231,18 +240,38 @@ void __noreturn ssl_entry(void) {
     print_error("Failed to load Third Stage Loader");
     goto halt;
   }
+  if (!verify_image(TSL_ADDR, (dword_t)read_context.sectors * SECTOR_SIZE)) {
+    print_error("Third Stage Loader is corrupted. CRC32 mismatch");
+    goto halt;
+  }
+
+  /* Read above 1MB without bounce buffer if BIOS supports EDD 3.0 */
+  (void)bios_detect_flat_reads(0x100000);
+
+  /* Find the largest transfer BIOS can do */
+  (void)bios_probe_max_transfer(0x100000);
 
   /* Load Kernel */
-  if (!load_kernel(kernel_partition, 0x100000)) {
+  if (!load_kernel(kernel_partition, 0x100000, &ramfs_size)) {
     print_error("Failed to load kernel");
     goto halt;
   }
 
+  /* Build page allocator, keep RAMFS */
+  if (!pmm_init(mem_map, 0x100000 + (qword_t)ramfs_size)) {
+    print_error("Failed to initialize page allocator");
+    goto halt;
+  }
+  pmm_reserve(0x100000, ramfs_size);
+
   /* Create boot info */
-  if ((boot_info = create_boot_info(drive_GUID, mem_map, 0x100000)) == NULL) {
+  if ((boot_info = create_boot_info(
+           drive_GUID, mem_map, 0x100000, ramfs_size
+       )) == NULL) {
     print_error("Failed to create boot info");
     goto halt;
   }
+  pmm_save_state(boot_info);
 
   /* Used for debug */
   dump_heap();
@@ -284,7 +313,7 @@ void __noreturn ssl_entry(void) {
       : [data_seg] "rmN"((word_t)2 * sizeof(GDT32_entry)),
         [jmp_addr] "rmN"((dword_t)TSL_ADDR - 5),
         [code_seg] "N"((word_t)1 * sizeof(GDT32_entry)),
-        [boot_info] "rmN"((dword_t)boot_info + ((dword_t)get_ds() << 4))
+        [boot_info] "rmN"(linear_address(boot_info))
       : "eax"
   );
 
@@ -25,13 +25,87 @@ int memcmp(void const* lhs, void const* rhs, size_t count) {
 }
 
 void* memcpy(void* dest, void const* src, size_t count) {
-  size_t i;
-  for (i = 0; i < count; ++i) { ((byte_t*)dest)[i] = ((byte_t*)src)[i]; }
+  void*       d    = dest;
+  void const* s    = src;
+  size_t      tail = count % sizeof(dword_t);
+
+  /* DS and ES are the same, offsets may be 32-bit in Unreal mode */
+  count /= sizeof(dword_t);
+  __asm__ volatile(
+      "cld\n"
+      "addr32 rep movsl\n"
+      "movl %[tail], %%ecx\n"
+      "addr32 rep movsb"
+      : "+D"(d), "+S"(s), "+c"(count)
+      : [tail] "r"(tail)
+      : "memory"
+  );
+
   return dest;
 }
 
 void* memset(void* ptr, int val, size_t count) {
-  byte_t* data = (byte_t*)ptr;
-  while (count--) { *data++ = (byte_t)val; }
+  void*  d    = ptr;
+  size_t tail = count % sizeof(dword_t);
+
+  count /= sizeof(dword_t);
+  __asm__ volatile(
+      "cld\n"
+      "addr32 rep stosl\n"
+      "movl %[tail], %%ecx\n"
+      "addr32 rep stosb"
+      : "+D"(d), "+c"(count)
+      : "a"((byte_t)val * 0x01010101UL), [tail] "r"(tail)
+      : "memory"
+  );
+
   return ptr;
 }
+
+void memcpy_linear(dword_t dest, dword_t src, dword_t count) {
+  dword_t tail = count % sizeof(dword_t);
+
+  count /= sizeof(dword_t);
+  __asm__ volatile(
+      "pushw %%ds\n" /* Use zero based segments */
+      "pushw %%es\n"
+      "xorw %%dx, %%dx\n"
+      "movw %%dx, %%ds\n"
+      "movw %%dx, %%es\n"
+
+      "cld\n"
+      "addr32 rep movsl\n" /* Copy with 32bit addresses */
+      "movl %[tail], %%ecx\n"
+      "addr32 rep movsb\n"
+
+      "popw %%es\n"
+      "popw %%ds"
+      : "+D"(dest), "+S"(src), "+c"(count)
+      : [tail] "r"(tail)
+      : "dx", "memory"
+  );
+}
+
+void memset_linear(dword_t dest, byte_t val, dword_t count) {
+  dword_t tail = count % sizeof(dword_t);
+
+  count /= sizeof(dword_t);
+  __asm__ volatile(
+      "pushw %%ds\n" /* Use zero based segments */
+      "pushw %%es\n"
+      "xorw %%dx, %%dx\n"
+      "movw %%dx, %%ds\n"
+      "movw %%dx, %%es\n"
+
+      "cld\n"
+      "addr32 rep stosl\n" /* Fill with 32bit addresses */
+      "movl %[tail], %%ecx\n"
+      "addr32 rep stosb\n"
+
+      "popw %%es\n"
+      "popw %%ds"
+      : "+D"(dest), "+c"(count)
+      : "a"(val * 0x01010101UL), [tail] "r"(tail)
+      : "dx", "memory"
+  );
+}
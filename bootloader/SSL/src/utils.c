@@ -5,56 +5,29 @@
  *
  */
 #include <bl/bios.h>
+#include <bl/io.h>
+#include <bl/log.h>
 #include <bl/mem.h>
 #include <bl/string.h>
 #include <bl/utils.h>
 
-/* CRC32 polynom table */
-static uint32_t const crc32table[256] = {
-  0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
-  0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
-  0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
-  0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-  0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
-  0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
-  0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
-  0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-  0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
-  0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
-  0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
-  0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-  0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
-  0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
-  0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
-  0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-  0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
-  0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
-  0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
-  0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-  0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
-  0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
-  0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
-  0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-  0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
-  0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
-  0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
-  0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-  0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
-  0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
-  0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
-  0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-  0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
-  0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
-  0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
-  0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-  0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
-  0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
-  0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
-  0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-  0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
-  0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
-  0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-};
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Reflected CRC32 polynomial */
+#  define CRC32_POLY 0xEDB88320UL
+
+/* Slicing-by-8 tables, built by crc32_init */
+static uint32_t _crc32_table[8][256];
+
+/* Header, placed right after the jump by the linker script */
+typedef struct __packed image_header {
+  dword_t magic;
+  dword_t size;
+  dword_t crc32;
+} image_header;
+
+#endif /* DOX_SKIP */
 
 /* Null partition type GUID */
 static byte_t const null_partition_type[] = { 0x00, 0x00, 0x00, 0x00,
@@ -69,10 +42,59 @@ word_t              get_ds(void) {
   return ds;
 }
 
+dword_t linear_address(void const* ptr) {
+  return ((dword_t)get_ds() << 4) + (dword_t)(uintptr_t)ptr;
+}
+
+void* linear_pointer(dword_t address) {
+  return (void*)(uintptr_t)(address - ((dword_t)get_ds() << 4));
+}
+
+void crc32_init(void) {
+  uint32_t crc;
+  size_t   i, j;
+
+  for (i = 0; i < 256; ++i) {
+    crc = (uint32_t)i;
+    for (j = 0; j < 8; ++j) { crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1)); }
+    _crc32_table[0][i] = crc;
+  }
+
+  /* Each next table advances CRC by one more zero byte */
+  for (i = 0; i < 256; ++i) {
+    for (j = 1; j < 8; ++j) {
+      crc                = _crc32_table[j - 1][i];
+      _crc32_table[j][i] = (crc >> 8) ^ _crc32_table[0][crc & 0xFF];
+    }
+  }
+}
+
+uint32_t crc32_update(uint32_t crc, byte_t const* buf, size_t len) {
+  uint32_t lo, hi;
+
+  crc = ~crc;
+
+  /* Align, then process 8 bytes per step */
+  for (; len != 0 && (uintptr_t)buf % 4 != 0; --len) {
+    crc = (crc >> 8) ^ _crc32_table[0][(crc ^ *buf++) & 0xFF];
+  }
+  for (; len >= 8; len -= 8, buf += 8) {
+    lo  = *(uint32_t const*)buf ^ crc;
+    hi  = *(uint32_t const*)(buf + 4);
+    crc = _crc32_table[7][lo & 0xFF] ^ _crc32_table[6][(lo >> 8) & 0xFF] ^
+          _crc32_table[5][(lo >> 16) & 0xFF] ^ _crc32_table[4][lo >> 24] ^
+          _crc32_table[3][hi & 0xFF] ^ _crc32_table[2][(hi >> 8) & 0xFF] ^
+          _crc32_table[1][(hi >> 16) & 0xFF] ^ _crc32_table[0][hi >> 24];
+  }
+  for (; len != 0; --len) {
+    crc = (crc >> 8) ^ _crc32_table[0][(crc ^ *buf++) & 0xFF];
+  }
+
+  return ~crc;
+}
+
 uint32_t crc32(byte_t const* buf, size_t len) {
-  uint32_t crc = 0xFFFFFFFF;
-  while (len--) { crc = (crc >> 8) ^ crc32table[(crc ^ *buf++) & 0xFF]; }
-  return crc ^ 0xFFFFFFFF;
+  return crc32_update(0, buf, len);
 }
 
 /* Check if A20 is enabled */
@@ -128,7 +150,7 @@ static bool _check_A20(void) {
   return ret;
 }
 
-static byte_t __inline__ _inb(word_t port) {
+byte_t inb(word_t port) {
   byte_t ret;
   __asm__ volatile("inb %[port], %[ret]"
                    : [ret] "=a"(ret)
@@ -136,7 +158,7 @@ static byte_t __inline__ _inb(word_t port) {
   return ret;
 }
 
-static void __inline__ _outb(word_t port, byte_t val) {
+void outb(word_t port, byte_t val) {
   __asm__ volatile("outb %[val], %[port]"
                    :
                    : [val] "a"(val), [port] "Nd"(port));
@@ -160,32 +182,32 @@ bool enable_A20(void) {
   }
 
   /* Try keyboard controller method */
-  while (_inb(0x64) & 2) { continue; }
-  _outb(0x64, 0xAD); /* Disable PS/2 port */
+  while (inb(0x64) & 2) { continue; }
+  outb(0x64, 0xAD); /* Disable PS/2 port */
 
-  while (_inb(0x64) & 2) { continue; }
-  _outb(0x64, 0xD0); /* Prepare to read data-output port */
+  while (inb(0x64) & 2) { continue; }
+  outb(0x64, 0xD0); /* Prepare to read data-output port */
 
-  while (!(_inb(0x64) & 1)) { continue; }
-  kb_data = _inb(0x60); /* Read data-output port */
+  while (!(inb(0x64) & 1)) { continue; }
+  kb_data = inb(0x60); /* Read data-output port */
 
-  while (_inb(0x64) & 2) { continue; }
-  _outb(0x64, 0xD1); /* Prepare to write to data-output port */
+  while (inb(0x64) & 2) { continue; }
+  outb(0x64, 0xD1); /* Prepare to write to data-output port */
 
-  while (_inb(0x64) & 2) { continue; }
-  _outb(0x60, kb_data | 2); /* Set A20 gate bit */
+  while (inb(0x64) & 2) { continue; }
+  outb(0x60, kb_data | 2); /* Set A20 gate bit */
 
-  while (_inb(0x64) & 2) { continue; }
-  _outb(0x64, 0xAE); /* Enable PS/2 port */
+  while (inb(0x64) & 2) { continue; }
+  outb(0x64, 0xAE); /* Enable PS/2 port */
 
-  while (_inb(0x64) & 2) { continue; }
+  while (inb(0x64) & 2) { continue; }
 
   if (_check_A20()) {
     return true;
   }
 
   /* Try Fast A20 method */
-  _outb(0x92, _inb(0x92) | 2);
+  outb(0x92, inb(0x92) | 2);
   if (_check_A20()) {
     return true;
   }
@@ -210,7 +232,7 @@ void set_GDT32_entry(
 
 void set_GDTR32(GDTR32* gdtr, GDT32_entry const* gdt32_table, size_t count) {
   *(word_t*)&gdtr->data[0]  = sizeof(GDT32_entry) * count - 1;
-  *(dword_t*)&gdtr->data[2] = ((dword_t)get_ds() << 4) | (dword_t)gdt32_table;
+  *(dword_t*)&gdtr->data[2] = linear_address(gdt32_table);
 }
 
 void load_GDT32(GDTR32 gdtr) {
@@ -248,6 +270,26 @@ void enter_unreal(word_t data_segment_offset) {
   );
 }
 
+bool verify_image(dword_t address, dword_t max_size) {
+  byte_t*       image = linear_pointer(address);
+  image_header* hdr   = (image_header*)(image + IMAGE_HEADER_OFFSET);
+  dword_t       crc;
+  bool          valid;
+
+  if (hdr->magic != IMAGE_MAGIC || hdr->size > max_size ||
+      hdr->size < IMAGE_HEADER_OFFSET + sizeof(image_header)) {
+    return false;
+  }
+
+  /* CRC32 is counted with CRC32 field being zero */
+  crc        = hdr->crc32;
+  hdr->crc32 = 0;
+  valid      = crc32(image, hdr->size) == crc;
+  hdr->crc32 = crc;
+
+  return valid;
+}
+
 GPT_partition_array* get_partition_array(GPT_header const* gpt_hdr) {
   GPT_partition_array* partition_array;
   dword_t              partition_table_size;
@@ -289,6 +331,15 @@ GPT_partition_array* get_partition_array(GPT_header const* gpt_hdr) {
     return NULL;
   }
 
+  /* Verify partition array before it's changed */
+  if (crc32((byte_t*)partition_array->array, partition_table_size) !=
+      gpt_hdr->partition_array_crc32) {
+    log_printf(LOG_ERROR, "GPT partition array CRC32 mismatch\n");
+    free(partition_array->array);
+    free(partition_array);
+    return NULL;
+  }
+
   /* Remove empty entries */
   li = 0;
   lp = partition_array->array;
@@ -385,40 +436,99 @@ static void _query_video(dword_t* type, dword_t* address) {
   *address = ret_addr;
 }
 
-bool load_kernel(GPT_partition_entry const* partition, dword_t address) {
-  void*   buffer;
-  DAP     read_context;
-  qword_t i;
-  qword_t sectors_count  = partition->end_lba - partition->start_lba + 1;
+/* ustar header */
+typedef struct posix_header {
+  char name[100];
+  char _unused0[24];
+  char size[12];
+  char _unused1[121];
+  char magic[6];
+  char _unused2[249];
+} posix_header;
+
+/* Parse octal number from ustar header field */
+static dword_t _str_oct_to_dec(char const* oct, size_t len) {
+  dword_t ret = 0;
+  while (len-- && '0' <= *oct && *oct <= '7') { ret = ret * 8 + *oct++ - '0'; }
+  return ret;
+}
 
-  address               -= (dword_t)get_ds() << 4;
+static dword_t __inline__ _align512(dword_t val) { return (val + 511) & -512; }
 
-  if ((buffer = malloc(SECTOR_SIZE)) == NULL) {
-    return false;
+/* Check if archive block is filled with zeros */
+static bool _is_zero_block(posix_header const* hdr) {
+  dword_t const* data = (dword_t const*)hdr;
+  size_t         i;
+  for (i = 0; i < SECTOR_SIZE / sizeof(dword_t); ++i) {
+    if (data[i] != 0) {
+      return false;
+    }
   }
+  return true;
+}
 
-  read_context.size    = sizeof(DAP);
-  read_context.rsv     = 0;
-  read_context.sectors = 1;
-  read_context.segment = get_ds();
-  read_context.offset  = (word_t)(uintptr_t)buffer;
-  read_context.lba     = partition->start_lba;
-
-  for (i = 0; i < sectors_count; ++i) {
-    if (!bios_read_drive(&read_context)) {
-      free(buffer);
+bool load_kernel(
+    GPT_partition_entry const* partition, dword_t address, dword_t* size
+) {
+  qword_t       lba          = partition->start_lba;
+  qword_t       sectors_left = partition->end_lba - partition->start_lba + 1;
+  byte_t const* archive;
+  dword_t       loaded, next_hdr, archive_end;
+  size_t        zero_blocks;
+
+  /* Loaded archive is addressed relative to DS */
+  archive     = linear_pointer(address);
+
+  loaded      = 0;
+  next_hdr    = 0;
+  archive_end = 0;
+  zero_blocks = 0;
+  while (sectors_left != 0 && archive_end == 0) {
+    word_t sectors = sectors_left < bios_max_transfer() ? (word_t)sectors_left
+                                                        : bios_max_transfer();
+
+    if (!bios_read_drive_linear(lba, sectors, address + loaded)) {
       return false;
     }
-    memcpy((byte_t*)address + (i * SECTOR_SIZE), buffer, SECTOR_SIZE);
-    ++read_context.lba;
+    loaded       += (dword_t)sectors * SECTOR_SIZE;
+    lba          += sectors;
+    sectors_left -= sectors;
+
+    /* Parse headers which arrived with this run */
+    while (next_hdr < loaded && archive_end == 0) {
+      posix_header const* hdr = (posix_header const*)(archive + next_hdr);
+
+      if (_is_zero_block(hdr)) {
+        /* Archive ends with two zero blocks */
+        next_hdr += SECTOR_SIZE;
+        if (++zero_blocks == 2) {
+          archive_end = next_hdr;
+        }
+      } else if (memcmp("ustar", hdr->magic, 5) != 0) {
+        /* Not an archive member, stop here */
+        archive_end = next_hdr;
+      } else {
+        zero_blocks  = 0;
+        next_hdr    += SECTOR_SIZE +
+                    _align512(_str_oct_to_dec(hdr->size, sizeof hdr->size));
+      }
+    }
+  }
+
+  /* Partition ended before end-of-archive marker */
+  if (archive_end == 0) {
+    archive_end = loaded;
   }
 
-  free(buffer);
+  *size = archive_end;
   return true;
 }
 
 boot_info_t* create_boot_info(
-    byte_t const* drive_GUID, memory_map* mem_map, qword_t ramfs_addr
+    byte_t const* drive_GUID,
+    memory_map*   mem_map,
+    qword_t       ramfs_addr,
+    qword_t       ramfs_size
 ) {
   boot_info_t*      boot_info;
   memory_map_entry* mem_map_array;
@@ -452,16 +562,37 @@ boot_info_t* create_boot_info(
   /* Fill memory map info */
   boot_info->memory_map.entry_size = sizeof(memory_map_entry);
   boot_info->memory_map.count      = mem_map->count;
-  boot_info->memory_map.address =
-      (dword_t)mem_map_array + ((dword_t)get_ds() << 4);
+  boot_info->memory_map.address    = linear_address(mem_map_array);
 
   /* Fill video info */
   _query_video(&video_type, &video_addr);
   boot_info->video_info.type    = video_type;
-  boot_info->video_info.address = video_addr + ((dword_t)get_ds() << 4);
+  boot_info->video_info.address = linear_address((void*)(uintptr_t)video_addr);
 
   /* Fill RAMFS info */
   boot_info->RAMFS.address      = ramfs_addr;
+  boot_info->RAMFS.size         = ramfs_size;
+
+  /* Fill boot log info */
+  boot_info->boot_log.address   = BOOT_LOG_ADDR;
+  boot_info->boot_log.size      = sizeof(boot_log_t) + BOOT_LOG_SIZE;
+
+  /* Module table is filled by TSL */
+  boot_info->modules.address    = 0;
+  boot_info->modules.count      = 0;
+  boot_info->modules.entry_size = sizeof(module_info_t);
+  boot_info->modules.names      = 0;
+  boot_info->modules.names_size = 0;
+
+  /* Deferred zeroing is requested by TSL */
+  boot_info->zero_ranges.address    = 0;
+  boot_info->zero_ranges.count      = 0;
+  boot_info->zero_ranges.entry_size = sizeof(memory_range_t);
+
+  /* Page tables are built by TSL */
+  boot_info->paging.pml4       = 0;
+  boot_info->paging.direct_map = 0;
+  boot_info->paging.pages      = 0;
 
   return boot_info;
 }
@@ -0,0 +1,32 @@
+/**
+ * @file crc32.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief CRC32 checksum
+ *
+ */
+#ifndef BL_CRC32_H
+#define BL_CRC32_H
+
+#include "defines.h"
+#include "types.h"
+
+/**
+ * @brief Build CRC32 tables
+ * @details Must be called before crc32_update()
+ *
+ */
+void    crc32_init(void);
+
+/**
+ * @brief Continue CRC32 checksum with more data
+ * @details Large buffers are folded with PCLMULQDQ, if CPU has it and SSE is
+ * enabled by stream_init(). The rest is processed with slicing-by-8
+ *
+ * @param [in] crc CRC32 checksum of preceding data, 0 for none
+ * @param [in] buf Pointer to a buffer to be examined
+ * @param [in] len Length of the buffer
+ * @return CRC32 checksum of preceding data and the buffer
+ */
+dword_t crc32_update(dword_t crc, void const* buf, size_t len);
+
+#endif /* BL_CRC32_H */
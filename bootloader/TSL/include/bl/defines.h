@@ -9,4 +9,8 @@
 #define __check_ret          __attribute__((warn_unused_result))
 #define __align(n)           __attribute__((aligned(n)))
 
+#define PAGE_SIZE            4096
+
+#define BOOT_LOG_MAGIC       0x474F4C56
+
 #endif /* BL_DEFINES_H */
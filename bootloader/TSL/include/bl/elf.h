@@ -0,0 +1,27 @@
+#ifndef BL_ELF_H
+#define BL_ELF_H
+
+#include <bl/defines.h>
+#include <bl/types.h>
+
+/**
+ * @brief Load ELF64 image into memory
+ * @details PT_LOAD segments are put to pages from the page allocator, unless
+ * image can run in place. Position independent images are relocated with
+ * R_X86_64_RELATIVE relocations, no symbols are resolved
+ *
+ * @param [in] filename Full path to ELF file in RAMFS
+ * @param [in] elf_addr Address of ELF file in RAMFS
+ * @param [in] file_size Size of ELF file
+ * @param [out] module Record of loaded module
+ * @return true on success
+ * @return false on failure
+ */
+bool elf_load(
+    char const*     filename,
+    void*           elf_addr,
+    size_t          file_size,
+    module_info_t** module
+);
+
+#endif
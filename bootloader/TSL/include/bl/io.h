@@ -57,4 +57,17 @@ int __print_fmt(2, 3) sprintf(char* s, char const* format, ...);
  */
 int __print_fmt(1, 2) serial_printf(char const* format, ...);
 
+/**
+ * @brief Print formatted data to boot log
+ * @details Message is echoed to COM port and terminal, if its level is enabled
+ * for them (see \ref log.h)
+ *
+ * @param [in] level Message level, e.g. \ref LOG_INFO
+ * @param [in] format C-string that contains a format string
+ * @param [in] ... Additional args
+ * @return The number of characters that would have been written if n had been
+ * sufficiently large, not counting the terminating null character
+ */
+int __print_fmt(2, 3) log_printf(int level, char const* format, ...);
+
 #endif /* BL_IO_H */
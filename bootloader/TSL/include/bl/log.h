@@ -0,0 +1,67 @@
+/**
+ * @file log.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Boot log ring buffer
+ *
+ */
+#ifndef BL_LOG_H
+#define BL_LOG_H
+
+#include "types.h"
+
+/**
+ * @brief Error messages
+ *
+ */
+#define LOG_ERROR 0
+
+/**
+ * @brief Warnings
+ *
+ */
+#define LOG_WARN  1
+
+/**
+ * @brief Boot progress
+ *
+ */
+#define LOG_INFO  2
+
+/**
+ * @brief Debug dumps
+ *
+ */
+#define LOG_DEBUG 3
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+/* Highest level echoed to COM port */
+#  ifndef LOG_SERIAL_LEVEL
+#    define LOG_SERIAL_LEVEL LOG_DEBUG
+#  endif /* LOG_SERIAL_LEVEL */
+#endif   /* DOX_SKIP */
+
+/**
+ * @brief Continue boot log, created by SSL
+ *
+ * @param [in] address Physical address of \ref boot_log_t "boot log"
+ * @return true on success
+ * @return false if there is no valid boot log at address
+ */
+bool log_init(qword_t address);
+
+/**
+ * @brief Append characters to boot log
+ *
+ * @param [in] span Pointer to characters
+ * @param [in] len Number of characters
+ */
+void log_write(char const* span, size_t len);
+
+/**
+ * @brief Update boot log header after a message
+ *
+ */
+void log_commit(void);
+
+#endif /* BL_LOG_H */
@@ -0,0 +1,94 @@
+/**
+ * @file module.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Loaded module table
+ *
+ */
+#ifndef BL_MODULE_H
+#define BL_MODULE_H
+
+#include "defines.h"
+#include "types.h"
+
+/**
+ * @brief All RAM is identity mapped, but TSL runs in 32-bit mode, so images
+ * are put to their preferred base only below 4GB
+ *
+ */
+#define MODULE_ADDRESS_LIMIT 0x100000000ULL
+
+/**
+ * @brief Initialize module loader
+ * @details Module table is put to pages from the page allocator
+ *
+ * @return true on success
+ * @return false on failure
+ */
+bool           module_loader_init(void);
+
+/**
+ * @brief Load PE32+ or ELF64 image into memory
+ * @details Image format is chosen by its magic. Module table grows while
+ * images are loaded, so returned record is valid only until the next call
+ *
+ * @param [in] filename Full path to image file in RAMFS
+ * @param [out] module Record of loaded module
+ * @return true on success
+ * @return false on failure
+ */
+bool           module_load(char const* filename, module_info_t** module);
+
+/**
+ * @brief Find loaded module
+ *
+ * @param [in] name Full path to image file in RAMFS
+ * @return Record of loaded module, valid until the next module is added\n
+ *         NULL if module isn't loaded
+ */
+module_info_t* module_find(char const* name);
+
+/**
+ * @brief Add module record
+ * @details Only name is filled, the rest of record is zeroed
+ *
+ * @param [in] name Full path to image file in RAMFS
+ * @return Record of added module, valid until the next module is added\n
+ *         NULL on failure
+ */
+module_info_t* module_add(char const* name);
+
+/**
+ * @brief Get count of module records
+ *
+ * @return Count of module records
+ */
+size_t         module_count(void);
+
+/**
+ * @brief Drop module records, added last
+ * @details Used to roll back a load that failed partway. Memory of dropped
+ * modules isn't freed
+ *
+ * @param [in] count Count of module records to keep, as module_count()
+ * returned before the load
+ */
+void           module_truncate(size_t count);
+
+/**
+ * @brief Zero module memory
+ * @details Large ranges may be left for kernel to zero, see
+ * \ref boot_info_t::zero_ranges "zero ranges"
+ *
+ * @param [in] address Physical address of the range
+ * @param [in] size Size of the range
+ */
+void           module_zero(dword_t address, size_t size);
+
+/**
+ * @brief Store module table to boot info
+ *
+ * @param [out] boot_info Pointer to the \ref boot_info_t "boot info" object
+ */
+void           module_save_state(boot_info_t* boot_info);
+
+#endif /* BL_MODULE_H */
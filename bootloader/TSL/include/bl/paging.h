@@ -0,0 +1,34 @@
+/**
+ * @file paging.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Page tables for the kernel
+ *
+ */
+#ifndef BL_PAGING_H
+#define BL_PAGING_H
+
+#include "defines.h"
+#include "types.h"
+
+/**
+ * @brief Builds page tables from the memory map
+ * @details Identity maps the first megabyte and all RAM from the memory map,
+ * except the first page, with 1GB pages where they fit, 2MB pages where they
+ * don't, and 4KB pages at region edges. Upper half of PML4 maps the same
+ * memory again, sharing lower tables with the identity map. All tables are
+ * put to one block from the page allocator, so it must be initialized first
+ *
+ * @param [in] boot_info Pointer to the \ref boot_info_t "boot info" object
+ * @return  Pointer to PML4 table\n
+ *          NULL on failure
+ */
+qword_t* __check_ret paging_build(boot_info_t const* boot_info);
+
+/**
+ * @brief Store page tables location to boot info
+ *
+ * @param [out] boot_info Pointer to the \ref boot_info_t "boot info" object
+ */
+void                 paging_save_state(boot_info_t* boot_info);
+
+#endif /* BL_PAGING_H */
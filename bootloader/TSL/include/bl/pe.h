@@ -4,39 +4,23 @@
 #include <bl/defines.h>
 #include <bl/types.h>
 
-typedef struct pe_load_state {
-  char    name[256];
-  dword_t load_addr;
-  dword_t image_size;
-  dword_t entry;
-  dword_t stack_size;
-} pe_load_state;
-
-/**
- * @brief Initialize PE loader
- *
- * @param [in] start Beginning of memory where PE images are put
- * @return true on success
- * @return false on failure
- */
-bool pe_loader_init(void* start);
-
-/**
- * @brief Get memory range used for loading PE images
- *
- * @param [out] begin Begin of memory range
- * @param [out] end End of memory range
- */
-void pe_get_memory_range(dword_t* begin, dword_t* end);
-
 /**
- * @brief Load PE into memory
+ * @brief Load PE32+ image into memory
+ * @details Image is put to pages from the page allocator, unless it can run
+ * in place. Imported DLLs are loaded with \ref module_load
  *
- * @param [in] file Full path to PE file in RAMFS
- * @param [out] state Result of loading
+ * @param [in] filename Full path to PE file in RAMFS
+ * @param [in] pe_addr Address of PE file in RAMFS
+ * @param [in] file_size Size of PE file
+ * @param [out] module Record of loaded module
  * @return true on success
  * @return false on failure
  */
-bool pe_load(char const* filename, pe_load_state** state);
+bool pe_load(
+    char const*     filename,
+    void*           pe_addr,
+    size_t          file_size,
+    module_info_t** module
+);
 
 #endif
@@ -0,0 +1,64 @@
+/**
+ * @file pmm.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Physical page allocator
+ *
+ */
+#ifndef BL_PMM_H
+#define BL_PMM_H
+
+#include "types.h"
+
+/**
+ * @brief Initialize physical page allocator
+ * @details Continues with the allocator state, built by SSL
+ *
+ * @param [in] boot_info Pointer to the \ref boot_info_t "boot info" object
+ * @return true on success
+ * @return false on failure
+ */
+bool __check_ret    pmm_init(boot_info_t const* boot_info);
+
+/**
+ * @brief Mark physical memory range as used
+ *
+ * @param [in] address Physical address of the range
+ * @param [in] size Size of the range
+ */
+void                pmm_reserve(qword_t address, qword_t size);
+
+/**
+ * @brief Allocate physically contiguous pages below 4GB
+ *
+ * @param [in] count Number of pages
+ * @return  Physical address of the first page\n
+ *          0 on failure
+ */
+qword_t __check_ret pmm_alloc(size_t count);
+
+/**
+ * @brief Allocate pages at the given physical address
+ *
+ * @param [in] address Physical address of the first page
+ * @param [in] count Number of pages
+ * @return true if all pages were free and are allocated now
+ * @return false on failure
+ */
+bool __check_ret    pmm_alloc_at(qword_t address, size_t count);
+
+/**
+ * @brief Free pages
+ *
+ * @param [in] address Physical address of the first page
+ * @param [in] count Number of pages
+ */
+void                pmm_free(qword_t address, size_t count);
+
+/**
+ * @brief Store allocator state to boot info
+ *
+ * @param [out] boot_info Pointer to the \ref boot_info_t "boot info" object
+ */
+void                pmm_save_state(boot_info_t* boot_info);
+
+#endif /* BL_PMM_H */
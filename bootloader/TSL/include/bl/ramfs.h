@@ -12,11 +12,16 @@
 
 /**
  * @brief Initialize RAMFS driver
+ * @details Builds file name hash index in memory from the page allocator,
+ * so it must be initialized first. If mkramfs wrote a manifest, its Merkle
+ * tree is checked against its root. If TSL is built with RAMFS_ROOT_HASH,
+ * RAMFS without manifest, or with another root, is rejected
  *
  * @param [in] address Address of RAMFS
+ * @param [in] size Size of RAMFS, reported by SSL
  * @return true on success
  */
-bool  ramfs_init(void* address);
+bool  ramfs_init(void* address, size_t size);
 
 /**
  * @brief Get memory right after RAMFS
@@ -27,10 +32,14 @@ void* ramfs_get_end(void);
 
 /**
  * @brief Get file from RAMFS
+ * @details If the index, written by mkramfs, carries CRC32 of files, or
+ * there is a manifest, file data is checked against them on the first lookup
+ * of the file. Later lookups return it as is
  *
- * @param [in] name Full filename
+ * @param [in] name Full filename, must match exactly
  * @param [out] size Actual file size
- * @return Pointer to the file in memory
+ * @return  Pointer to the file in memory\n
+ *          NULL if there is no such regular file or it's corrupted
  */
 void* ramfs_file(char const* name, size_t* size);
 
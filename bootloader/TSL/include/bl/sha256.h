@@ -0,0 +1,73 @@
+/**
+ * @file sha256.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief SHA-256 hash
+ *
+ */
+#ifndef BL_SHA256_H
+#define BL_SHA256_H
+
+#include "defines.h"
+#include "types.h"
+
+/**
+ * @brief Size of SHA-256 digest in bytes
+ *
+ */
+#define SHA256_SIZE 32
+
+/**
+ * @brief SHA-256 hashing state
+ *
+ */
+typedef struct sha256_t {
+  /**
+   * @brief Intermediate hash
+   *
+   */
+  dword_t state[8];
+  /**
+   * @brief Number of bytes hashed so far
+   *
+   */
+  qword_t length;
+  /**
+   * @brief Incomplete block, waiting for more data
+   *
+   */
+  byte_t  block[64];
+} sha256_t;
+
+/**
+ * @brief Chooses SHA-256 implementation
+ * @details SHA extensions are used if CPU has them and SSE is enabled by
+ * stream_init(), otherwise unrolled scalar rounds are used
+ *
+ */
+void sha256_init(void);
+
+/**
+ * @brief Starts new hash
+ *
+ * @param [out] ctx Pointer to the hashing state
+ */
+void sha256_start(sha256_t* ctx);
+
+/**
+ * @brief Continues hash with more data
+ *
+ * @param [in,out] ctx Pointer to the hashing state
+ * @param [in] buf Pointer to a buffer to be hashed
+ * @param [in] len Length of the buffer
+ */
+void sha256_update(sha256_t* ctx, void const* buf, size_t len);
+
+/**
+ * @brief Pads the data and writes the digest
+ *
+ * @param [in,out] ctx Pointer to the hashing state
+ * @param [out] digest Buffer of SHA256_SIZE bytes for the digest
+ */
+void sha256_finish(sha256_t* ctx, byte_t* digest);
+
+#endif /* BL_SHA256_H */
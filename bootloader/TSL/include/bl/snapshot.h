@@ -0,0 +1,28 @@
+/**
+ * @file snapshot.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Prelinked boot snapshot
+ *
+ */
+#ifndef BL_SNAPSHOT_H
+#define BL_SNAPSHOT_H
+
+#include "defines.h"
+#include "types.h"
+
+/**
+ * @brief Load modules from prelinked boot snapshot
+ * @details Snapshot is made by mksnapshot and stored as `ramfs/.snapshot`.
+ * It holds kernel and its DLLs, already laid out, relocated and bound for a
+ * fixed physical address, so it's copied there as a whole. Snapshot is used
+ * only if its first module is the requested one and all its modules in RAMFS
+ * match the files it was made from
+ *
+ * @param [in] filename Full path to kernel image in RAMFS
+ * @param [out] module Record of loaded kernel
+ * @return true on success
+ * @return false if snapshot is missing, outdated or can't be placed
+ */
+bool snapshot_load(char const* filename, module_info_t** module);
+
+#endif /* BL_SNAPSHOT_H */
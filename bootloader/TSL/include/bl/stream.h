@@ -0,0 +1,53 @@
+/**
+ * @file stream.h
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Non-temporal copy of large buffers
+ *
+ */
+#ifndef BL_STREAM_H
+#define BL_STREAM_H
+
+#include "defines.h"
+#include "types.h"
+
+/**
+ * @brief Enables SSE and calibrates streaming copy
+ * @details Sets CR0.MP and CR4.OSFXSR, clears CR0.EM and CR0.TS, remembering
+ * their previous state. Then times regular and streaming copies of growing
+ * size with RDTSC, in scratch pages from the page allocator, to find the size
+ * from which streaming pays off. Without SSE2 streaming stays disabled
+ *
+ */
+void  stream_init(void);
+
+/**
+ * @brief Copies buffer, bypassing cache if it's large
+ * @details Buffers of calibrated size and above are copied with MOVNTDQ,
+ * followed by SFENCE. Use it for data, which won't be read before kernel
+ * runs. Smaller buffers, or any buffers if streaming is disabled, are copied
+ * with memcpy
+ *
+ * @param [out] dest Pointer to the object to copy to
+ * @param [in] src Pointer to the object to copy from
+ * @param [in] count Number of bytes to copy
+ * @return dest
+ */
+void* stream_copy(void* dest, void const* src, size_t count);
+
+/**
+ * @brief Checks if SSE may be used
+ *
+ * @return true - SSE is enabled by stream_init() and not yet restored
+ * @return false - SSE registers mustn't be touched
+ */
+bool  stream_has_sse(void);
+
+/**
+ * @brief Restores FPU and SSE control bits
+ * @details Clears SSE registers and puts CR0 and CR4 bits changed by
+ * stream_init() back. Must be called before jumping to the kernel
+ *
+ */
+void  stream_fini(void);
+
+#endif /* BL_STREAM_H */
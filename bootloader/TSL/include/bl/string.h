@@ -9,6 +9,15 @@
 
 #include "types.h"
 
+/**
+ * @brief Selects copy and fill strategy for this CPU
+ * @details REP MOVSB and REP STOSB are used when CPU reports ERMSB, for short
+ * buffers too if it reports FSRM. Until called, and on older CPUs, buffers are
+ * processed by dwords
+ *
+ */
+void               string_init(void);
+
 /**
  * @brief Returns the length of a given string
  *
@@ -17,6 +26,16 @@
  */
 size_t __check_ret strlen(char const* str);
 
+/**
+ * @brief Compares two null-terminated byte strings lexicographically
+ *
+ * @param [in] lhs Pointer to the first string
+ * @param [in] rhs Pointer to the second string
+ * @return Negative value if lhs appears before rhs, zero if they compare
+ * equal, positive value if lhs appears after rhs
+ */
+int __check_ret    strcmp(char const* lhs, char const* rhs);
+
 /**
  * @brief Compares two buffers
  *
@@ -81,6 +81,64 @@ bool    check_cpuid(void);
  */
 bool    check_cpu_compat(void);
 
+/**
+ * @brief Checks for SSE2
+ *
+ * @return true - SSE2 is implemented
+ * @return false - SSE2 is not implemented
+ */
+bool    check_cpu_sse2(void);
+
+/**
+ * @brief Checks for carry-less multiplication
+ *
+ * @return true - PCLMULQDQ is implemented
+ * @return false - PCLMULQDQ is not implemented
+ */
+bool    check_cpu_pclmul(void);
+
+/**
+ * @brief Checks for Time Stamp Counter
+ *
+ * @return true - RDTSC is implemented
+ * @return false - RDTSC is not implemented
+ */
+bool    check_cpu_tsc(void);
+
+/**
+ * @brief Checks for 1GB pages
+ *
+ * @return true - PDPT entries may map 1GB pages
+ * @return false - 1GB pages are not implemented
+ */
+bool    check_cpu_pg1g(void);
+
+/**
+ * @brief Checks for Enhanced REP MOVSB/STOSB
+ *
+ * @return true - byte string instructions are as fast as dword ones
+ * @return false - ERMSB is not implemented
+ */
+bool    check_cpu_erms(void);
+
+/**
+ * @brief Checks for Fast Short REP MOVSB
+ *
+ * @return true - byte string instructions are fast for short strings too
+ * @return false - FSRM is not implemented
+ */
+bool    check_cpu_fsrm(void);
+
+/**
+ * @brief Checks for SHA extensions
+ * @details SSSE3 and SSE4.1 are required too, SHA-256 rounds use their
+ * shuffles
+ *
+ * @return true - SHA256RNDS2 and message instructions are implemented
+ * @return false - SHA extensions are not implemented
+ */
+bool    check_cpu_sha(void);
+
 /**
  * @brief Enables Physical Address Extension
  *
@@ -0,0 +1,214 @@
+/**
+ * @file crc32.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief CRC32 checksum
+ * @details Built with SSE registers allowed, for PCLMULQDQ folding
+ *
+ */
+#include <bl/crc32.h>
+#include <bl/stream.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Reflected CRC32 polynomial */
+#  define CRC32_POLY 0xEDB88320UL
+
+/* Smaller buffers aren't worth folding */
+#  define FOLD_MIN   128
+
+/* Folding and Barrett reduction constants for reflected polynomial, see
+ * Intel's "Fast CRC Computation Using PCLMULQDQ Instruction" */
+static dword_t const _k1k2[4] = { 0x54442BD4, 0x1, 0xC6E41596, 0x1 };
+static dword_t const _k3k4[4] = { 0x751997D0, 0x1, 0xCCAA009E, 0x0 };
+static dword_t const _k5[4]   = { 0x63CD6124, 0x1, 0x0, 0x0 };
+static dword_t const _poly[4] = { 0xDB710641, 0x1, 0xF7011641, 0x1 };
+static dword_t const _mask[4] = { 0xFFFFFFFF, 0x0, 0x0, 0x0 };
+
+static struct {
+  bool    pclmul;
+  dword_t table[8][256]; /* Slicing-by-8 tables */
+} _ctx;
+
+/* Slicing-by-8, CRC is taken and returned without final inversion */
+static dword_t _slice(dword_t crc, byte_t const* buf, size_t len) {
+  dword_t lo, hi;
+
+  for (; len != 0 && (uintptr_t)buf % 4 != 0; --len) {
+    crc = (crc >> 8) ^ _ctx.table[0][(crc ^ *buf++) & 0xFF];
+  }
+  for (; len >= 8; len -= 8, buf += 8) {
+    lo  = *(dword_t const*)buf ^ crc;
+    hi  = *(dword_t const*)(buf + 4);
+    crc = _ctx.table[7][lo & 0xFF] ^ _ctx.table[6][(lo >> 8) & 0xFF] ^
+          _ctx.table[5][(lo >> 16) & 0xFF] ^ _ctx.table[4][lo >> 24] ^
+          _ctx.table[3][hi & 0xFF] ^ _ctx.table[2][(hi >> 8) & 0xFF] ^
+          _ctx.table[1][(hi >> 16) & 0xFF] ^ _ctx.table[0][hi >> 24];
+  }
+  for (; len != 0; --len) {
+    crc = (crc >> 8) ^ _ctx.table[0][(crc ^ *buf++) & 0xFF];
+  }
+
+  return crc;
+}
+
+/* Fold 16-byte aligned buffer with carry-less multiplication. Length is a
+ * multiple of 16 and at least 64. CRC is taken and returned without final
+ * inversion */
+static dword_t _fold(dword_t crc, byte_t const* buf, size_t len) {
+  __asm__ volatile(
+      "movdqa (%[buf]), %%xmm1\n"
+      "movdqa 16(%[buf]), %%xmm2\n"
+      "movdqa 32(%[buf]), %%xmm3\n"
+      "movdqa 48(%[buf]), %%xmm4\n"
+      "movd %[crc], %%xmm0\n"
+      "pxor %%xmm0, %%xmm1\n"
+      "sub $64, %[len]\n"
+      "add $64, %[buf]\n"
+      "movdqu %[k1k2], %%xmm0\n"
+
+      /* Fold 4 lanes of 16 bytes */
+      "cmp $64, %[len]\n"
+      "jb 2f\n"
+      "1:\n"
+      "movdqa %%xmm1, %%xmm5\n"
+      "movdqa %%xmm2, %%xmm6\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm2\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm5\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm6\n"
+      "pxor %%xmm5, %%xmm1\n"
+      "pxor %%xmm6, %%xmm2\n"
+      "pxor (%[buf]), %%xmm1\n"
+      "pxor 16(%[buf]), %%xmm2\n"
+      "movdqa %%xmm3, %%xmm5\n"
+      "movdqa %%xmm4, %%xmm6\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm3\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm4\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm5\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm6\n"
+      "pxor %%xmm5, %%xmm3\n"
+      "pxor %%xmm6, %%xmm4\n"
+      "pxor 32(%[buf]), %%xmm3\n"
+      "pxor 48(%[buf]), %%xmm4\n"
+      "sub $64, %[len]\n"
+      "add $64, %[buf]\n"
+      "cmp $64, %[len]\n"
+      "jae 1b\n"
+
+      /* Fold lanes into one */
+      "2:\n"
+      "movdqu %[k3k4], %%xmm0\n"
+      "movdqa %%xmm1, %%xmm5\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm5\n"
+      "pxor %%xmm5, %%xmm1\n"
+      "pxor %%xmm2, %%xmm1\n"
+      "movdqa %%xmm1, %%xmm5\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm5\n"
+      "pxor %%xmm5, %%xmm1\n"
+      "pxor %%xmm3, %%xmm1\n"
+      "movdqa %%xmm1, %%xmm5\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm5\n"
+      "pxor %%xmm5, %%xmm1\n"
+      "pxor %%xmm4, %%xmm1\n"
+
+      /* Fold the rest by 16 bytes */
+      "cmp $16, %[len]\n"
+      "jb 4f\n"
+      "3:\n"
+      "movdqa %%xmm1, %%xmm5\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pclmulqdq $0x11, %%xmm0, %%xmm5\n"
+      "pxor %%xmm5, %%xmm1\n"
+      "pxor (%[buf]), %%xmm1\n"
+      "sub $16, %[len]\n"
+      "add $16, %[buf]\n"
+      "cmp $16, %[len]\n"
+      "jae 3b\n"
+
+      /* Fold 128 bits to 64 */
+      "4:\n"
+      "pclmulqdq $0x01, %%xmm1, %%xmm0\n"
+      "psrldq $8, %%xmm1\n"
+      "pxor %%xmm0, %%xmm1\n"
+
+      /* Fold 64 bits to 32 */
+      "movdqa %%xmm1, %%xmm2\n"
+      "movdqu %[k5], %%xmm0\n"
+      "movdqu %[mask], %%xmm3\n"
+      "psrldq $4, %%xmm2\n"
+      "pand %%xmm3, %%xmm1\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pxor %%xmm2, %%xmm1\n"
+
+      /* Barrett reduction to 32 bits */
+      "movdqu %[poly], %%xmm0\n"
+      "movdqa %%xmm1, %%xmm2\n"
+      "pand %%xmm3, %%xmm1\n"
+      "pclmulqdq $0x10, %%xmm0, %%xmm1\n"
+      "pand %%xmm3, %%xmm1\n"
+      "pclmulqdq $0x00, %%xmm0, %%xmm1\n"
+      "pxor %%xmm2, %%xmm1\n"
+      "psrldq $4, %%xmm1\n"
+      "movd %%xmm1, %[crc]"
+      : [crc] "+r"(crc), [buf] "+r"(buf), [len] "+r"(len)
+      : [k1k2] "m"(_k1k2),
+        [k3k4] "m"(_k3k4),
+        [k5] "m"(_k5),
+        [poly] "m"(_poly),
+        [mask] "m"(_mask)
+      : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+        "cc", "memory"
+  );
+  return crc;
+}
+
+#endif /* DOX_SKIP */
+
+void crc32_init(void) {
+  dword_t crc;
+  size_t  i, j;
+
+  for (i = 0; i < 256; ++i) {
+    crc = (dword_t)i;
+    for (j = 0; j < 8; ++j) { crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1)); }
+    _ctx.table[0][i] = crc;
+  }
+
+  /* Each next table advances CRC by one more zero byte */
+  for (i = 0; i < 256; ++i) {
+    for (j = 1; j < 8; ++j) {
+      crc              = _ctx.table[j - 1][i];
+      _ctx.table[j][i] = (crc >> 8) ^ _ctx.table[0][crc & 0xFF];
+    }
+  }
+
+  _ctx.pclmul = check_cpu_pclmul();
+}
+
+dword_t crc32_update(dword_t crc, void const* buf, size_t len) {
+  byte_t const* data = buf;
+  size_t        head, bulk;
+
+  crc = ~crc;
+
+  /* Fold aligned middle of large buffers */
+  if (_ctx.pclmul && len >= FOLD_MIN && stream_has_sse()) {
+    head  = -(uintptr_t)data % 16;
+    crc   = _slice(crc, data, head);
+    data += head;
+    len  -= head;
+
+    bulk  = len - len % 16;
+    crc   = _fold(crc, data, bulk);
+    data += bulk;
+    len  -= bulk;
+  }
+  crc = _slice(crc, data, len);
+
+  return ~crc;
+}
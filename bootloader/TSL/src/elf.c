@@ -0,0 +1,362 @@
+/**
+ * @file elf.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief ELF64 image loader
+ *
+ */
+#include <bl/elf.h>
+#include <bl/module.h>
+#include <bl/pmm.h>
+#include <bl/stream.h>
+#include <bl/string.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+typedef struct __packed elf_header {
+  byte_t  ident[16];
+  word_t  type;
+  word_t  machine;
+  dword_t version;
+  qword_t entry;
+  qword_t phoff;
+  qword_t shoff;
+  dword_t flags;
+  word_t  ehsize;
+  word_t  phentsize;
+  word_t  phnum;
+  word_t  shentsize;
+  word_t  shnum;
+  word_t  shstrndx;
+} elf_header;
+
+typedef struct __packed program_header {
+  dword_t type;
+  dword_t flags;
+  qword_t offset;
+  qword_t vaddr;
+  qword_t paddr;
+  qword_t filesz;
+  qword_t memsz;
+  qword_t align;
+} program_header;
+
+typedef struct __packed dynamic_entry {
+  qword_t tag;
+  qword_t value;
+} dynamic_entry;
+
+typedef struct __packed rela_entry {
+  qword_t offset;
+  qword_t info;
+  qword_t addend;
+} rela_entry;
+
+/* Identification */
+#  define EI_CLASS           4
+#  define EI_DATA            5
+#  define ELFCLASS64         2
+#  define ELFDATA2LSB        1
+#  define EM_X86_64          62
+
+/* Object file types */
+#  define ET_EXEC            2
+#  define ET_DYN             3
+
+/* Segment types */
+#  define PT_LOAD            1
+#  define PT_DYNAMIC         2
+#  define PT_GNU_STACK       0x6474E551
+
+/* Dynamic tags */
+#  define DT_NULL            0
+#  define DT_RELA            7
+#  define DT_RELASZ          8
+#  define DT_RELAENT         9
+#  define DT_REL             17
+#  define DT_JMPREL          23
+#  define DT_RELR            36
+
+/* Relocation types */
+#  define R_X86_64_NONE      0
+#  define R_X86_64_RELATIVE  8
+
+/* Images have to fit into 32-bit address space of TSL */
+#  define IMAGE_SIZE_LIMIT   0x100000000ULL
+
+/* Stack size for images without PT_GNU_STACK size */
+#  define DEFAULT_STACK_SIZE 0x10000
+
+/* Checks if image can be run where it lies in RAMFS. Each segment must be at
+ * the same offset in file and in memory, and clearing BSS mustn't go past the
+ * file or overwrite program headers */
+static bool _can_run_in_place(
+    void const*           elf_addr,
+    size_t                file_size,
+    qword_t               base,
+    elf_header const*     hdr,
+    program_header const* phdrs
+) {
+  qword_t phdrs_end = hdr->phoff + hdr->phnum * sizeof(program_header);
+  size_t  i;
+
+  if ((dword_t)elf_addr % PAGE_SIZE != 0) {
+    return false;
+  }
+
+  for (i = 0; i < hdr->phnum; ++i) {
+    if (phdrs[i].type != PT_LOAD) {
+      continue;
+    }
+    if (phdrs[i].offset != phdrs[i].vaddr - base ||
+        phdrs[i].offset + phdrs[i].memsz > file_size ||
+        (phdrs[i].offset + phdrs[i].filesz < phdrs_end &&
+         phdrs[i].offset + phdrs[i].memsz > hdr->phoff)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Checks relocations from dynamic segment before any of them is applied, so
+ * a broken table never leaves image half relocated. Relocation table and
+ * targets must lie within the image, and targets outside of the table. Only
+ * relative relocations are supported, other tables are ignored if image isn't
+ * moved */
+static bool _check_relocs(
+    byte_t const*         image,
+    qword_t               base,
+    qword_t               image_size,
+    program_header const* dynamic,
+    qword_t               delta,
+    rela_entry const**    table,
+    size_t*               count
+) {
+  dynamic_entry const* entry;
+  dynamic_entry const* entries_end;
+  rela_entry const*    rela;
+  rela_entry const*    rela_end;
+  qword_t              rela_addr = 0, rela_size = 0;
+  qword_t              rela_entry_size = sizeof(rela_entry);
+  qword_t              rela_offset, target;
+
+  *table = NULL;
+  *count = 0;
+  if (dynamic->vaddr < base || dynamic->vaddr - base > image_size ||
+      dynamic->memsz > image_size - (dynamic->vaddr - base)) {
+    return false;
+  }
+
+  /* Find relocation table */
+  entry = (dynamic_entry const*)(image + (dword_t)(dynamic->vaddr - base));
+  entries_end = entry + dynamic->memsz / sizeof(dynamic_entry);
+  for (; entry < entries_end && entry->tag != DT_NULL; ++entry) {
+    switch (entry->tag) {
+    case DT_RELA: rela_addr = entry->value; break;
+    case DT_RELASZ: rela_size = entry->value; break;
+    case DT_RELAENT: rela_entry_size = entry->value; break;
+    case DT_REL:
+    case DT_JMPREL:
+    case DT_RELR:
+      if (delta != 0) {
+        return false;
+      }
+      break;
+    default: break;
+    }
+  }
+
+  if (rela_size == 0) {
+    return true;
+  }
+  rela_offset = rela_addr - base;
+  if (rela_entry_size != sizeof(rela_entry) || rela_addr < base ||
+      rela_offset > image_size || rela_size > image_size - rela_offset) {
+    return false;
+  }
+
+  rela     = (rela_entry const*)(image + (dword_t)rela_offset);
+  rela_end = rela + rela_size / sizeof(rela_entry);
+  for (; rela < rela_end; ++rela) {
+    switch ((dword_t)rela->info) {
+    case R_X86_64_RELATIVE:
+      target = rela->offset - base;
+      if (rela->offset < base || target > image_size ||
+          image_size - target < sizeof(qword_t) ||
+          (target + sizeof(qword_t) > rela_offset &&
+           target < rela_offset + rela_size)) {
+        return false;
+      }
+      break;
+    case R_X86_64_NONE: break;
+    default: return false;
+    }
+  }
+
+  *table = (rela_entry const*)(image + (dword_t)rela_offset);
+  *count = (size_t)(rela_size / sizeof(rela_entry));
+  return true;
+}
+
+/* Apply relative relocations, checked by _check_relocs() */
+static void _relocate(
+    dword_t load_addr, qword_t base, rela_entry const* rela, size_t count
+) {
+  qword_t delta = load_addr - base;
+
+  for (; count != 0; --count, ++rela) {
+    if ((dword_t)rela->info == R_X86_64_RELATIVE) {
+      *(qword_t*)(load_addr + (dword_t)(rela->offset - base)) =
+          delta + rela->addend;
+    }
+  }
+}
+
+#endif /* DOX_SKIP */
+
+bool elf_load(
+    char const*     filename,
+    void*           elf_addr,
+    size_t          file_size,
+    module_info_t** module
+) {
+  elf_header*           hdr = elf_addr;
+  program_header*       phdrs;
+  program_header const* dynamic    = NULL;
+  qword_t               base       = ~0ULL;
+  qword_t               end        = 0;
+  qword_t               stack_size = 0;
+  size_t                image_pages;
+  bool                  in_place;
+  dword_t               load_addr;
+  module_info_t*        loaded;
+  rela_entry const*     rela       = NULL;
+  size_t                rela_count = 0;
+  byte_t*               dest;
+  size_t                i;
+
+  /* Verify header */
+  if (file_size < sizeof(elf_header) || hdr->ident[EI_CLASS] != ELFCLASS64 ||
+      hdr->ident[EI_DATA] != ELFDATA2LSB || hdr->machine != EM_X86_64 ||
+      (hdr->type != ET_EXEC && hdr->type != ET_DYN) ||
+      hdr->phentsize != sizeof(program_header) ||
+      hdr->phoff + hdr->phnum * sizeof(program_header) > file_size) {
+    return false;
+  }
+  phdrs = (program_header*)((byte_t*)elf_addr + (dword_t)hdr->phoff);
+
+  /* Find image bounds */
+  for (i = 0; i < hdr->phnum; ++i) {
+    switch (phdrs[i].type) {
+    case PT_LOAD:
+      if (phdrs[i].filesz > phdrs[i].memsz ||
+          phdrs[i].offset + phdrs[i].filesz > file_size) {
+        return false;
+      }
+      if (phdrs[i].vaddr < base) {
+        base = phdrs[i].vaddr;
+      }
+      if (phdrs[i].vaddr + phdrs[i].memsz > end) {
+        end = phdrs[i].vaddr + phdrs[i].memsz;
+      }
+      break;
+    case PT_DYNAMIC: dynamic = &phdrs[i]; break;
+    case PT_GNU_STACK: stack_size = phdrs[i].memsz; break;
+    default: break;
+    }
+  }
+  base &= ~(qword_t)(PAGE_SIZE - 1);
+  if (end <= base || end - base > IMAGE_SIZE_LIMIT ||
+      (hdr->type == ET_EXEC && end > IMAGE_SIZE_LIMIT)) {
+    return false;
+  }
+  image_pages = (size_t)((end - base + PAGE_SIZE - 1) / PAGE_SIZE);
+
+  /* Image runs in place only if its whole relocation table checks out, so
+   * RAMFS is never left half patched. Otherwise it's copied, preferably to
+   * its linked address */
+  if (_can_run_in_place(elf_addr, file_size, base, hdr, phdrs) &&
+      (hdr->type == ET_DYN || (dword_t)elf_addr == base) &&
+      (dynamic == NULL || _check_relocs(
+                              elf_addr,
+                              base,
+                              end - base,
+                              dynamic,
+                              (dword_t)elf_addr - base,
+                              &rela,
+                              &rela_count
+                          ))) {
+    /* Image is already laid out, RAMFS is identity mapped, so only BSS tails
+     * need to be cleared */
+    load_addr   = (dword_t)elf_addr;
+    image_pages = 0;
+    in_place    = true;
+  } else {
+    /* Allocate image memory at linked address, so no relocation is needed,
+     * or anywhere if image is position independent */
+    if (base + image_pages * PAGE_SIZE <= MODULE_ADDRESS_LIMIT &&
+        pmm_alloc_at(base, image_pages)) {
+      load_addr = (dword_t)base;
+    } else if (hdr->type != ET_DYN ||
+               (load_addr = (dword_t)pmm_alloc(image_pages)) == 0) {
+      return false;
+    }
+    in_place = false;
+  }
+
+  /* Load segments and clear their BSS tails */
+  for (i = 0; i < hdr->phnum; ++i) {
+    if (phdrs[i].type != PT_LOAD) {
+      continue;
+    }
+
+    dest = (byte_t*)load_addr + (dword_t)(phdrs[i].vaddr - base);
+    if (!in_place && phdrs[i].filesz != 0) {
+      stream_copy(
+          dest,
+          (byte_t*)elf_addr + (dword_t)phdrs[i].offset,
+          (size_t)phdrs[i].filesz
+      );
+    }
+    if (phdrs[i].memsz > phdrs[i].filesz) {
+      module_zero(
+          (dword_t)dest + (dword_t)phdrs[i].filesz,
+          (size_t)(phdrs[i].memsz - phdrs[i].filesz)
+      );
+    }
+  }
+
+  /* Fix addresses for the actual load address. Relocations of image, run in
+   * place, are already checked */
+  if (!in_place && dynamic != NULL &&
+      !_check_relocs(
+          (byte_t const*)load_addr,
+          base,
+          end - base,
+          dynamic,
+          load_addr - base,
+          &rela,
+          &rela_count
+      )) {
+    pmm_free(load_addr, image_pages);
+    return false;
+  }
+  _relocate(load_addr, base, rela, rela_count);
+
+  if ((loaded = module_add(filename)) == NULL) {
+    pmm_free(load_addr, image_pages);
+    return false;
+  }
+  loaded->address    = load_addr;
+  loaded->image_size = (dword_t)(end - base);
+  loaded->stack_size =
+      stack_size != 0 ? (dword_t)stack_size : DEFAULT_STACK_SIZE;
+  loaded->entry = load_addr + (hdr->entry - base);
+
+  if (module != NULL) {
+    *module = loaded;
+  }
+
+  return true;
+}
@@ -5,45 +5,166 @@
  *
  */
 #include <bl/io.h>
+#include <bl/log.h>
 #include <bl/string.h>
 #include <bl/utils.h>
 
 /* Leave this undocumented */
 #ifndef DOX_SKIP
 
-/* Write function prototype */
-typedef void (*buffer_fcn)(
-    void* buffer, size_t max_size, size_t index, char ch
-);
+/* Output writer */
+typedef struct writer writer_t;
+
+/* Output sink */
+typedef struct {
+  /* Write contiguous span of characters */
+  void (*write)(writer_t* writer, char const* span, size_t len);
+
+  /* Write run of the same character */
+  void (*fill)(writer_t* writer, char ch, size_t count);
+
+  /* End of output */
+  void (*finish)(writer_t* writer);
+} sink_t;
+
+struct writer {
+  sink_t const* sink;
+  char*         buffer;
+  size_t        max_size;
+  size_t        index;
+  int           level;
+};
+
+/* Size of fill runs passed to sinks, which can only write spans */
+#  define FILL_CHUNK 16
+
+/* Write fill run as a sequence of spans */
+static void _fill_spans(
+    writer_t* writer,
+    char      ch,
+    size_t    count,
+    void (*write)(writer_t* writer, char const* span, size_t len)
+) {
+  char   chunk[FILL_CHUNK];
+  size_t run;
+
+  memset(chunk, ch, count < FILL_CHUNK ? count : FILL_CHUNK);
+  while (count != 0) {
+    run    = count < FILL_CHUNK ? count : FILL_CHUNK;
+    write(writer, chunk, run);
+    count -= run;
+  }
+}
 
 /* Write to memory buffer */
-static void _buffer_mem(void* buffer, size_t max_size, size_t index, char ch) {
-  if (index < max_size) {
-    ((char*)buffer)[index] = ch;
+static void _mem_write(writer_t* writer, char const* span, size_t len) {
+  size_t room;
+
+  if (writer->index < writer->max_size) {
+    room = writer->max_size - writer->index;
+    memcpy(writer->buffer + writer->index, span, len < room ? len : room);
+  }
+}
+
+static void _mem_fill(writer_t* writer, char ch, size_t count) {
+  size_t room;
+
+  if (writer->index < writer->max_size) {
+    room = writer->max_size - writer->index;
+    memset(writer->buffer + writer->index, ch, count < room ? count : room);
+  }
+}
+
+static void _mem_finish(writer_t* writer) {
+  if (writer->max_size != 0) {
+    writer->buffer
+        [writer->index < writer->max_size ? writer->index
+                                          : writer->max_size - 1] = '\0';
   }
 }
 
 /* Write to COM port */
-static void
-_buffer_serial(void* buffer, size_t max_size, size_t index, char ch) {
-  (void)buffer;
-  (void)max_size;
-  (void)index;
-
-  if (ch == '\n') {
-    serial_putch('\r');
-    serial_putch('\n');
-  } else {
-    serial_putch(ch);
+static void _serial_write(writer_t* writer, char const* span, size_t len) {
+  (void)writer;
+
+  while (len--) {
+    if (*span == '\n') {
+      serial_putch('\r');
+    }
+    serial_putch(*span++);
   }
 }
 
+static void _serial_fill(writer_t* writer, char ch, size_t count) {
+  (void)writer;
+
+  while (count--) { serial_putch(ch); }
+}
+
+/* Write to boot log and echo to sinks enabled for message level */
+static void _log_write(writer_t* writer, char const* span, size_t len) {
+  log_write(span, len);
+
+  if (writer->level <= LOG_SERIAL_LEVEL) {
+    _serial_write(writer, span, len);
+  }
+}
+
+static void _log_fill(writer_t* writer, char ch, size_t count) {
+  _fill_spans(writer, ch, count, _log_write);
+}
+
+static void _log_finish(writer_t* writer) {
+  (void)writer;
+
+  log_commit();
+}
+
 /* Don't write */
-static void _buffer_null(void* buffer, size_t max_size, size_t index, char ch) {
-  (void)buffer;
-  (void)max_size;
-  (void)index;
+static void _null_write(writer_t* writer, char const* span, size_t len) {
+  (void)writer;
+  (void)span;
+  (void)len;
+}
+
+static void _null_fill(writer_t* writer, char ch, size_t count) {
+  (void)writer;
   (void)ch;
+  (void)count;
+}
+
+static void _null_finish(writer_t* writer) { (void)writer; }
+
+static sink_t const _sink_mem    = {_mem_write, _mem_fill, _mem_finish};
+static sink_t const _sink_serial = {_serial_write, _serial_fill, _null_finish};
+static sink_t const _sink_log    = {_log_write, _log_fill, _log_finish};
+static sink_t const _sink_null   = {_null_write, _null_fill, _null_finish};
+
+/* Prepare writer */
+static void _writer_init(
+    writer_t* writer, sink_t const* sink, char* buffer, size_t max_size
+) {
+  writer->sink     = buffer != NULL || sink != &_sink_mem ? sink : &_sink_null;
+  writer->buffer   = buffer;
+  writer->max_size = max_size;
+  writer->index    = 0U;
+  writer->level    = LOG_DEBUG;
+}
+
+/* Write span and advance output index */
+static void _write(writer_t* writer, char const* span, size_t len) {
+  if (len != 0) {
+    writer->sink->write(writer, span, len);
+    writer->index += len;
+  }
+}
+
+/* Write fill run and advance output index */
+static void _fill(writer_t* writer, char ch, size_t count) {
+  if (count != 0) {
+    writer->sink->fill(writer, ch, count);
+    writer->index += count;
+  }
 }
 
 /* Format flags */
@@ -66,58 +187,24 @@ static void _buffer_null(void* buffer, size_t max_size, size_t index, char ch) {
 #  define FLAG_INTMAX    (1U << 12)
 
 /* Writes formatted output */
-static size_t _format_output(
-    buffer_fcn  write,
-    void*       buffer,
-    size_t      max_size,
-    size_t      index,
+static void _format_output(
+    writer_t*   writer,
     char const* output,
     size_t      output_size,
     uint16_t    flags,
     uint16_t    width
 ) {
-  size_t i;
-  char   fill = flags & FLAG_ZERO ? '0' : ' ';
+  size_t fill_size = width > output_size ? width - output_size : 0U;
+  char   fill      = flags & FLAG_ZERO ? '0' : ' ';
 
   if (flags & FLAG_LEFT) {
-    /* Left-Justification*/
-
-    /* Write output string first */
-    for (i = 0U; i < output_size; ++i) {
-      write(buffer, max_size, index++, *output++);
-    }
-
-    /* Pad if output_size < width */
-    for (; i < width; ++i) { write(buffer, max_size, index++, fill); }
+    /* Left-Justification */
+    _write(writer, output, output_size);
+    _fill(writer, fill, fill_size);
   } else {
     /* Right-Justification */
-
-    /* Calculate fill size, assuming width is unsigned (if output_size >
-     * width then output_size
-     * - width will be incorrect) */
-    width = width < output_size ? 0 : width - output_size;
-
-    /* Pad if calculated fill size > 0 */
-    for (i = 0U; i < width; ++i) { write(buffer, max_size, index++, fill); }
-
-    /* Write output string */
-    for (i = 0U; i < output_size; ++i) {
-      write(buffer, max_size, index++, *output++);
-    }
-  }
-
-  return index;
-}
-
-/* Reverse string */
-static void _reverse(char* buff, size_t buff_size) {
-  size_t i, j;
-  char   c;
-
-  for (i = 0, j = buff_size - 1; i < j; ++i, --j) {
-    c       = buff[i];
-    buff[i] = buff[j];
-    buff[j] = c;
+    _fill(writer, fill, fill_size);
+    _write(writer, output, output_size);
   }
 }
 
@@ -125,67 +212,93 @@ static void _reverse(char* buff, size_t buff_size) {
 static char   hcase_alphabet[] = "0123456789ABCDEF";
 static char   lcase_alphabet[] = "0123456789abcdef";
 
-/* Converts number to formatted string */
-static size_t _ntoa(
+/* Size of number conversion buffer */
+#  define NUM_BUFFER_SIZE 32
+
+/* Converts number to formatted string, which ends at num_end */
+static char* _ntoa(
     uintmax_t num,
     bool      negative,
     uint8_t   radix,
-    char*     num_buffer,
+    char*     num_end,
     uint16_t  flags,
     uint16_t  precision,
     bool      hcase
 ) {
-  size_t index = 0U;
+  char const* alphabet = hcase ? hcase_alphabet : lcase_alphabet;
+  char*       start    = num_end;
+  uint32_t    chunk;
+  uint8_t     shift;
+  int         i;
+
+  /* Write digits backwards, so the result needs no reversal */
+  if ((radix & (radix - 1)) == 0) {
+    /* Digits of power of two radix are bit fields */
+    for (shift = 0; (1U << shift) < radix; ++shift) { continue; }
+    do {
+      *--start = alphabet[(uint32_t)num & (radix - 1)];
+    } while ((num >>= shift) > 0);
+  } else {
+    /* Split off 9 decimal digits per 64bit division */
+    while (radix == 10 && num > UINT32_MAX) {
+      chunk = (uint32_t)(num % 1000000000U);
+      num  /= 1000000000U;
+      for (i = 0; i < 9; ++i) {
+        *--start  = alphabet[chunk % 10];
+        chunk    /= 10;
+      }
+    }
 
-  /* Write digits in reverse sequence */
-  do {
-    num_buffer[index++] =
-        (hcase ? hcase_alphabet : lcase_alphabet)[num % radix];
-  } while ((num /= radix) > 0);
+    /* Other radixes need 64bit division per digit */
+    while (num > UINT32_MAX) {
+      *--start  = alphabet[num % radix];
+      num      /= radix;
+    }
 
-  /* Pad number if precision > index */
+    /* Rest of the number fits in 32 bits */
+    chunk = (uint32_t)num;
+    do { *--start = alphabet[chunk % radix]; } while ((chunk /= radix) > 0);
+  }
+
+  /* Pad number if precision > number of digits, leave room for prefix */
   if (flags & FLAG_PRECISION) {
-    while (index < precision) { num_buffer[index++] = '0'; }
+    if (precision > NUM_BUFFER_SIZE - 4) {
+      precision = NUM_BUFFER_SIZE - 4;
+    }
+    while ((size_t)(num_end - start) < precision) { *--start = '0'; }
   }
 
   /* Add prefix */
   if (flags & FLAG_HASH) {
     if (radix == 16) {
-      num_buffer[index++] = hcase ? 'X' : 'x';
+      *--start = hcase ? 'X' : 'x';
     }
     if (radix % 8 == 0) {
-      num_buffer[index++] = '0';
+      *--start = '0';
     }
   }
 
   /* Write sign */
   if (negative) {
-    num_buffer[index++] = '-';
+    *--start = '-';
   } else if (flags & FLAG_SIGN) {
-    num_buffer[index++] = '+';
+    *--start = '+';
   } else if (flags & FLAG_SPACE) {
-    num_buffer[index++] = ' ';
+    *--start = ' ';
   }
 
-  /* Reverse buffer */
-  _reverse(num_buffer, index);
-
-  return index;
+  return start;
 }
 
 /* Internal vsnprintf */
-static int _vsnprintf(
-    void*       buffer,
-    size_t      max_size,
-    char const* format,
-    va_list     va,
-    buffer_fcn  write
-) {
-  size_t   index = 0U, num_size;
-  uint16_t flags, width, precision;
-  bool     flags_loop;
-  uint8_t  radix;
-  char     num_buffer[32];
+static int _vsnprintf(writer_t* writer, char const* format, va_list va) {
+  char const* literal;
+  char        num_buffer[NUM_BUFFER_SIZE];
+  char*       num_start;
+  char* const num_end = num_buffer + NUM_BUFFER_SIZE;
+  uint16_t    flags, width, precision;
+  bool        flags_loop;
+  uint8_t     radix;
 
   union {
     char               char_type;
@@ -205,13 +318,12 @@ static int _vsnprintf(
     uintptr_t          ptr_type;
   } arg;
 
-  if (!buffer) {
-    write = _buffer_null;
-  }
-
   while (*format) {
     if (*format != '%') {
-      write(buffer, max_size, index++, *format++);
+      /* Write literal run up to the next conversion */
+      literal = format;
+      while (*format && *format != '%') { format++; }
+      _write(writer, literal, format - literal);
     } else {
       format++;
 
@@ -332,17 +444,17 @@ static int _vsnprintf(
           arg.int_type = va_arg(va, int);
         }
 
-        num_size = _ntoa(
+        num_start = _ntoa(
             arg.intmax_type < 0 ? -arg.intmax_type : arg.intmax_type,
             arg.intmax_type < 0,
             10,
-            num_buffer,
+            num_end,
             flags,
             precision,
             false
         );
-        index = _format_output(
-            write, buffer, max_size, index, num_buffer, num_size, flags, width
+        _format_output(
+            writer, num_start, num_end - num_start, flags, width
         );
 
         format++;
@@ -377,17 +489,17 @@ static int _vsnprintf(
         case 'X': radix = 16; break;
         }
 
-        num_size = _ntoa(
+        num_start = _ntoa(
             arg.uintmax_type,
             false,
             radix,
-            num_buffer,
+            num_end,
             flags,
             precision,
             *format == 'X' ? true : false
         );
-        index = _format_output(
-            write, buffer, max_size, index, num_buffer, num_size, flags, width
+        _format_output(
+            writer, num_start, num_end - num_start, flags, width
         );
 
         format++;
@@ -400,15 +512,8 @@ static int _vsnprintf(
           arg.int_type = va_arg(va, int);
         }
 
-        index = _format_output(
-            write,
-            buffer,
-            max_size,
-            index,
-            (char const*)&arg.int_type,
-            1,
-            flags,
-            width
+        _format_output(
+            writer, (char const*)&arg.int_type, 1, flags, width
         );
 
         format++;
@@ -418,11 +523,8 @@ static int _vsnprintf(
         if (flags & FLAG_LONG)
           /* WCHAR_T won't be implemented */;
         else {
-          index = _format_output(
-              write,
-              buffer,
-              max_size,
-              index,
+          _format_output(
+              writer,
               (char const*)arg.ptr_type,
               strlen((char const*)arg.ptr_type),
               flags,
@@ -437,11 +539,11 @@ static int _vsnprintf(
         arg.ptr_type      = (uintptr_t)va_arg(va, void*);
 
         flags            |= FLAG_HASH;
-        num_size          = _ntoa(
-            arg.uintmax_type, false, 16, num_buffer, flags, precision, false
+        num_start         = _ntoa(
+            arg.uintmax_type, false, 16, num_end, flags, precision, false
         );
-        index = _format_output(
-            write, buffer, max_size, index, num_buffer, num_size, flags, width
+        _format_output(
+            writer, num_start, num_end - num_start, flags, width
         );
 
         format++;
@@ -449,75 +551,96 @@ static int _vsnprintf(
       case 'n': {
         arg.ptr_type = (uintptr_t)va_arg(va, void*);
         if (flags & FLAG_CHAR) {
-          *(char*)arg.ptr_type = index;
+          *(char*)arg.ptr_type = writer->index;
         } else if (flags & FLAG_SHORT) {
-          *(short*)arg.ptr_type = index;
+          *(short*)arg.ptr_type = writer->index;
         } else if (flags & FLAG_LONG_LONG) {
-          *(long long*)arg.ptr_type = index;
+          *(long long*)arg.ptr_type = writer->index;
         } else if (flags & FLAG_LONG) {
-          *(long*)arg.ptr_type = index;
+          *(long*)arg.ptr_type = writer->index;
         } else if (flags & FLAG_INTMAX) {
-          *(intmax_t*)arg.ptr_type = index;
+          *(intmax_t*)arg.ptr_type = writer->index;
         } else if (flags & FLAG_SIZE) {
-          *(size_t*)arg.ptr_type = index;
+          *(size_t*)arg.ptr_type = writer->index;
         } else if (flags & FLAG_PTRDIFF) {
-          *(ptrdiff_t*)arg.ptr_type = index;
+          *(ptrdiff_t*)arg.ptr_type = writer->index;
         } else {
-          *(int*)arg.ptr_type = index;
+          *(int*)arg.ptr_type = writer->index;
         }
 
         format++;
       } break;
       case '%': {
-        index = _format_output(
-            write, buffer, max_size, index, format++, 1, flags, width
-        );
+        _format_output(writer, format++, 1, flags, width);
       } break;
       default: format++;
       }
     }
   }
 
-  /* Place null-terminator */
-  write(buffer, max_size, index < max_size ? index : max_size - 1, '\0');
-  return index;
+  /* Place null-terminator or flush */
+  writer->sink->finish(writer);
+  return writer->index;
 }
 
 #endif /* DOX_SKIP */
 
 int vsnprintf(char* s, size_t n, char const* format, va_list arg) {
-  return _vsnprintf(s, n, format, arg, _buffer_mem);
+  writer_t writer;
+
+  _writer_init(&writer, &_sink_mem, s, n);
+  return _vsnprintf(&writer, format, arg);
 }
 
 int snprintf(char* s, size_t n, char const* format, ...) {
-  va_list va;
-  int     ret;
+  writer_t writer;
+  va_list  va;
+  int      ret;
 
+  _writer_init(&writer, &_sink_mem, s, n);
   va_start(va, format);
-  ret = _vsnprintf(s, n, format, va, _buffer_mem);
+  ret = _vsnprintf(&writer, format, va);
   va_end(va);
 
   return ret;
 }
 
 int sprintf(char* s, char const* format, ...) {
-  va_list va;
-  int     ret;
+  writer_t writer;
+  va_list  va;
+  int      ret;
 
+  _writer_init(&writer, &_sink_mem, s, SIZE_MAX);
   va_start(va, format);
-  ret = _vsnprintf(s, SIZE_MAX, format, va, _buffer_mem);
+  ret = _vsnprintf(&writer, format, va);
   va_end(va);
 
   return ret;
 }
 
 int serial_printf(char const* format, ...) {
-  va_list va;
-  char    buffer[1];
-  int     ret;
+  writer_t writer;
+  va_list  va;
+  int      ret;
+
+  _writer_init(&writer, &_sink_serial, NULL, 0);
+  va_start(va, format);
+  ret = _vsnprintf(&writer, format, va);
+  va_end(va);
+
+  return ret;
+}
+
+int log_printf(int level, char const* format, ...) {
+  writer_t writer;
+  va_list  va;
+  int      ret;
+
+  _writer_init(&writer, &_sink_log, NULL, 0);
+  writer.level = level;
 
   va_start(va, format);
-  ret = _vsnprintf(buffer, SIZE_MAX, format, va, _buffer_serial);
+  ret = _vsnprintf(&writer, format, va);
   va_end(va);
 
   return ret;
@@ -0,0 +1,65 @@
+/**
+ * @file log.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Boot log ring buffer
+ *
+ */
+#include <bl/log.h>
+#include <bl/string.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Log writer state */
+static struct {
+  boot_log_t* log;
+  char*       text;
+  dword_t     pos;
+  dword_t     written;
+} _log_ctx;
+
+#endif /* DOX_SKIP */
+
+bool log_init(qword_t address) {
+  boot_log_t* log = (boot_log_t*)(uintptr_t)address;
+
+  _log_ctx.log    = NULL;
+  if (address == 0 || address >> 32 != 0 || log->magic != BOOT_LOG_MAGIC ||
+      log->size == 0) {
+    return false;
+  }
+
+  _log_ctx.log     = log;
+  _log_ctx.text    = (char*)(log + 1);
+  _log_ctx.written = log->written;
+  _log_ctx.pos     = log->written % log->size;
+  return true;
+}
+
+void log_write(char const* span, size_t len) {
+  if (_log_ctx.log == NULL) {
+    return;
+  }
+
+  while (len != 0) {
+    /* Copy up to the end of ring buffer */
+    size_t run = _log_ctx.log->size - _log_ctx.pos;
+    if (run > len) {
+      run = len;
+    }
+
+    memcpy(_log_ctx.text + _log_ctx.pos, span, run);
+    span             += run;
+    len              -= run;
+    _log_ctx.written += run;
+    if ((_log_ctx.pos += run) == _log_ctx.log->size) {
+      _log_ctx.pos = 0;
+    }
+  }
+}
+
+void log_commit(void) {
+  if (_log_ctx.log != NULL) {
+    _log_ctx.log->written = _log_ctx.written;
+  }
+}
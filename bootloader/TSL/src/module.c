@@ -0,0 +1,277 @@
+/**
+ * @file module.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Loaded module table
+ *
+ */
+#include <bl/elf.h>
+#include <bl/module.h>
+#include <bl/pe.h>
+#include <bl/pmm.h>
+#include <bl/ramfs.h>
+#include <bl/string.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* FNV-1a parameters, module names are hashed the same way as RAMFS names */
+#  define FNV_OFFSET_BASIS 0x811C9DC5UL
+#  define FNV_PRIME        0x01000193UL
+
+/* Module index starts with a single page of slots */
+#  define INDEX_MIN_SLOTS  (PAGE_SIZE / sizeof(dword_t))
+
+/* BSS tails of this size and above are left for kernel to zero, 0 disables
+ * deferring */
+#  ifndef PE_DEFER_ZERO_THRESHOLD
+#    define PE_DEFER_ZERO_THRESHOLD 0
+#  endif
+
+static struct {
+  /* Module records in load order */
+  module_info_t*  modules;
+  size_t          count;
+  size_t          modules_size;
+  /* Open addressed index of module number + 1, keyed by name hash */
+  dword_t*        index;
+  size_t          index_slots;
+  /* NUL-terminated module names */
+  char*           names;
+  size_t          names_used;
+  size_t          names_size;
+  /* Ranges, left for kernel to zero */
+  memory_range_t* zero_ranges;
+  size_t          zero_count;
+  size_t          zero_ranges_size;
+} _ctx;
+
+static dword_t _hash(char const* name) {
+  dword_t hash = FNV_OFFSET_BASIS;
+  while (*name != '\0') {
+    hash = (hash ^ (byte_t)*name++) * FNV_PRIME;
+  }
+  return hash;
+}
+
+/* Make room for needed bytes after used ones in page allocated array, doubling
+ * its size. Returns the array, moved if it had to grow, or NULL on failure */
+static void* _reserve(void* array, size_t* size, size_t used, size_t needed) {
+  size_t  new_size = *size != 0 ? *size : PAGE_SIZE;
+  qword_t address;
+
+  if (used + needed <= *size) {
+    return array;
+  }
+  while (new_size < used + needed) {
+    new_size *= 2;
+  }
+
+  if ((address = pmm_alloc(new_size / PAGE_SIZE)) == 0) {
+    return NULL;
+  }
+  if (array != NULL) {
+    memcpy((void*)(uintptr_t)address, array, used);
+    pmm_free((uintptr_t)array, *size / PAGE_SIZE);
+  }
+
+  *size = new_size;
+  return (void*)(uintptr_t)address;
+}
+
+static void _index_insert(size_t module) {
+  size_t mask = _ctx.index_slots - 1;
+  size_t slot = _ctx.modules[module].hash & mask;
+
+  while (_ctx.index[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  _ctx.index[slot] = (dword_t)module + 1;
+}
+
+static void _fill_index(void) {
+  size_t i;
+
+  memset(_ctx.index, 0, _ctx.index_slots * sizeof(dword_t));
+  for (i = 0; i < _ctx.count; ++i) {
+    _index_insert(i);
+  }
+}
+
+static bool _rebuild_index(size_t slots) {
+  qword_t address = pmm_alloc(slots * sizeof(dword_t) / PAGE_SIZE);
+
+  if (address == 0) {
+    return false;
+  }
+  if (_ctx.index != NULL) {
+    pmm_free(
+        (uintptr_t)_ctx.index, _ctx.index_slots * sizeof(dword_t) / PAGE_SIZE
+    );
+  }
+
+  _ctx.index       = (dword_t*)(uintptr_t)address;
+  _ctx.index_slots = slots;
+  _fill_index();
+
+  return true;
+}
+
+#endif /* DOX_SKIP */
+
+bool module_loader_init(void) {
+  memset(&_ctx, 0, sizeof _ctx);
+  return true;
+}
+
+bool module_load(char const* filename, module_info_t** module) {
+  module_info_t* loaded;
+  byte_t*        image;
+  size_t         size;
+
+  /* Check if already loaded */
+  if ((loaded = module_find(filename)) != NULL) {
+    if (module) {
+      *module = loaded;
+    }
+    return true;
+  }
+
+  /* Open the file */
+  if ((image = ramfs_file(filename, &size)) == NULL || size < 4) {
+    return false;
+  }
+
+  /* Choose loader by magic */
+  if (!memcmp(image, "\177ELF", 4)) {
+    return elf_load(filename, image, size, module);
+  } else if (image[0] == 'M' && image[1] == 'Z') {
+    return pe_load(filename, image, size, module);
+  }
+
+  return false;
+}
+
+module_info_t* module_find(char const* name) {
+  dword_t        hash = _hash(name);
+  module_info_t* module;
+  size_t         mask = _ctx.index_slots - 1;
+  size_t         slot;
+
+  if (_ctx.index_slots == 0) {
+    return NULL;
+  }
+
+  for (slot = hash & mask; _ctx.index[slot] != 0; slot = (slot + 1) & mask) {
+    module = &_ctx.modules[_ctx.index[slot] - 1];
+    if (module->hash == hash && strcmp(_ctx.names + module->name, name) == 0) {
+      return module;
+    }
+  }
+
+  return NULL;
+}
+
+module_info_t* module_add(char const* name) {
+  size_t         name_size = strlen(name) + 1;
+  size_t         slots =
+      _ctx.index_slots != 0 ? _ctx.index_slots : INDEX_MIN_SLOTS;
+  void*          array;
+  module_info_t* record;
+
+  if ((array = _reserve(
+           _ctx.modules,
+           &_ctx.modules_size,
+           _ctx.count * sizeof(module_info_t),
+           sizeof(module_info_t)
+       )) == NULL) {
+    return NULL;
+  }
+  _ctx.modules = array;
+
+  if ((array = _reserve(
+           _ctx.names, &_ctx.names_size, _ctx.names_used, name_size
+       )) == NULL) {
+    return NULL;
+  }
+  _ctx.names = array;
+
+  /* Index load factor is kept at most 1/2 */
+  while (slots < 2 * (_ctx.count + 1)) {
+    slots *= 2;
+  }
+  if (slots != _ctx.index_slots && !_rebuild_index(slots)) {
+    return NULL;
+  }
+
+  record             = &_ctx.modules[_ctx.count];
+  record->hash       = _hash(name);
+  record->name       = (dword_t)_ctx.names_used;
+  record->address    = 0;
+  record->entry      = 0;
+  record->image_size = 0;
+  record->stack_size = 0;
+  memcpy(_ctx.names + _ctx.names_used, name, name_size);
+  _ctx.names_used += name_size;
+  _index_insert(_ctx.count++);
+
+  return record;
+}
+
+size_t module_count(void) {
+  return _ctx.count;
+}
+
+void module_truncate(size_t count) {
+  if (count >= _ctx.count) {
+    return;
+  }
+
+  _ctx.names_used = _ctx.modules[count].name;
+  _ctx.count      = count;
+  _fill_index();
+}
+
+void module_zero(dword_t address, size_t size) {
+#if PE_DEFER_ZERO_THRESHOLD != 0
+  memory_range_t* last;
+  void*           array;
+
+  if (size >= PE_DEFER_ZERO_THRESHOLD) {
+    /* Merge with previous range, if adjacent */
+    if (_ctx.zero_count != 0) {
+      last = &_ctx.zero_ranges[_ctx.zero_count - 1];
+      if (last->address + last->size == address) {
+        last->size += size;
+        return;
+      }
+    }
+
+    if ((array = _reserve(
+             _ctx.zero_ranges,
+             &_ctx.zero_ranges_size,
+             _ctx.zero_count * sizeof(memory_range_t),
+             sizeof(memory_range_t)
+         )) != NULL) {
+      _ctx.zero_ranges                          = array;
+      _ctx.zero_ranges[_ctx.zero_count].address = address;
+      _ctx.zero_ranges[_ctx.zero_count].size    = size;
+      ++_ctx.zero_count;
+      return;
+    }
+  }
+#endif
+
+  memset((void*)address, 0, size);
+}
+
+void module_save_state(boot_info_t* boot_info) {
+  boot_info->modules.address    = (uintptr_t)_ctx.modules;
+  boot_info->modules.count      = (dword_t)_ctx.count;
+  boot_info->modules.entry_size = sizeof(module_info_t);
+  boot_info->modules.names      = (uintptr_t)_ctx.names;
+  boot_info->modules.names_size = (dword_t)_ctx.names_used;
+
+  boot_info->zero_ranges.address    = (uintptr_t)_ctx.zero_ranges;
+  boot_info->zero_ranges.count      = (dword_t)_ctx.zero_count;
+  boot_info->zero_ranges.entry_size = sizeof(memory_range_t);
+}
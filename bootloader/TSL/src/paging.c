@@ -0,0 +1,242 @@
+/**
+ * @file paging.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Page tables for the kernel
+ *
+ */
+#include <bl/paging.h>
+#include <bl/pmm.h>
+#include <bl/string.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Page table entry bits */
+#  define PAGE_PRESENT    0x1ULL
+#  define PAGE_WRITE      0x2ULL
+#  define PAGE_LARGE      0x80ULL
+#  define PAGE_ADDRESS    0x000FFFFFFFFFF000ULL
+#  define TABLE_FLAGS     (PAGE_WRITE | PAGE_PRESENT)
+#  define LARGE_FLAGS     (PAGE_LARGE | PAGE_WRITE | PAGE_PRESENT)
+
+/* Sizes, mapped by a single entry of each level */
+#  define SIZE_4KB        0x1000ULL
+#  define SIZE_2MB        0x200000ULL
+#  define SIZE_1GB        0x40000000ULL
+#  define SIZE_512GB      0x8000000000ULL
+
+/* Entries per table */
+#  define TABLE_ENTRIES   512
+
+/* Identity map takes the lower half of PML4, direct map takes the upper */
+#  define DIRECT_MAP_SLOT 256
+#  define DIRECT_MAP_BASE 0xFFFF800000000000ULL
+#  define MAP_LIMIT       (DIRECT_MAP_SLOT * SIZE_512GB)
+
+/* Memory map types, which are RAM */
+#  define MEMORY_USABLE   1
+#  define MEMORY_ACPI     3
+#  define MEMORY_NVS      4
+
+/* SSL, TSL, boot log and BIOS data live there, whatever memory map says */
+#  define LOW_MEMORY_END  0x100000ULL
+
+static struct {
+  qword_t* pml4;
+  qword_t  tables; /* Block of page tables, PML4 is the first one */
+  size_t   pages;  /* Size of the block */
+  size_t   used;   /* Tables taken from the block */
+  bool     pg1g;
+} _ctx;
+
+/* Insert range, keeping ranges sorted by address */
+static size_t
+_add_range(memory_range_t* ranges, size_t count, qword_t start, qword_t end) {
+  size_t i;
+
+  if (start >= end) {
+    return count;
+  }
+
+  for (i = count; i != 0 && ranges[i - 1].address > start; --i) {
+    ranges[i] = ranges[i - 1];
+  }
+  ranges[i].address = start;
+  ranges[i].size    = end - start;
+  return count + 1;
+}
+
+/* Merge overlapping and adjacent ranges, so they get the largest pages */
+static size_t _merge_ranges(memory_range_t* ranges, size_t count) {
+  size_t  i, last;
+  qword_t end;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  for (last = 0, i = 1; i < count; ++i) {
+    end = ranges[last].address + ranges[last].size;
+    if (ranges[i].address > end) {
+      ranges[++last] = ranges[i];
+    } else if (ranges[i].address + ranges[i].size > end) {
+      ranges[last].size = ranges[i].address + ranges[i].size -
+                          ranges[last].address;
+    }
+  }
+  return last + 1;
+}
+
+/* Upper bound of tables, needed to map the range. Each range needs PDPTs
+ * for all 512GB it touches, and PDs and PTs only for its partly mapped
+ * 1GB and 2MB edges */
+static size_t _count_tables(memory_range_t const* range) {
+  qword_t first = range->address;
+  qword_t last  = range->address + range->size - 1;
+  size_t  pds;
+
+  pds = _ctx.pg1g ? 2 : (size_t)((last >> 30) - (first >> 30) + 1);
+  return (size_t)((last >> 39) - (first >> 39) + 1) + pds + 2;
+}
+
+/* Get table, the entry points to, taking a new one from the block if the
+ * entry is empty */
+static qword_t* _next_table(qword_t* table, size_t index) {
+  qword_t address;
+
+  if ((table[index] & PAGE_PRESENT) == 0) {
+    if (_ctx.used == _ctx.pages) {
+      return NULL;
+    }
+    address = _ctx.tables + _ctx.used++ * PAGE_SIZE;
+    memset((void*)(uintptr_t)address, 0, PAGE_SIZE);
+    table[index] = address | TABLE_FLAGS;
+  }
+
+  return (qword_t*)(uintptr_t)(table[index] & PAGE_ADDRESS);
+}
+
+/* Identity map page aligned range with the largest pages that fit */
+static bool _map(qword_t start, qword_t end) {
+  qword_t* pdpt;
+  qword_t* pd;
+  qword_t* pt;
+
+  while (start < end) {
+    pdpt = _next_table(_ctx.pml4, (size_t)(start >> 39) % TABLE_ENTRIES);
+    if (pdpt == NULL) {
+      return false;
+    }
+    if (_ctx.pg1g && (start & (SIZE_1GB - 1)) == 0 &&
+        end - start >= SIZE_1GB) {
+      pdpt[(start >> 30) % TABLE_ENTRIES]  = start | LARGE_FLAGS;
+      start                               += SIZE_1GB;
+      continue;
+    }
+
+    pd = _next_table(pdpt, (size_t)(start >> 30) % TABLE_ENTRIES);
+    if (pd == NULL) {
+      return false;
+    }
+    if ((start & (SIZE_2MB - 1)) == 0 && end - start >= SIZE_2MB) {
+      pd[(start >> 21) % TABLE_ENTRIES]  = start | LARGE_FLAGS;
+      start                             += SIZE_2MB;
+      continue;
+    }
+
+    pt = _next_table(pd, (size_t)(start >> 21) % TABLE_ENTRIES);
+    if (pt == NULL) {
+      return false;
+    }
+    pt[(start >> 12) % TABLE_ENTRIES]  = start | TABLE_FLAGS;
+    start                             += SIZE_4KB;
+  }
+
+  return true;
+}
+
+#endif /* DOX_SKIP */
+
+qword_t* paging_build(boot_info_t const* boot_info) {
+  memory_map_entry const* entry;
+  memory_range_t*         ranges;
+  qword_t                 scratch, start, end;
+  size_t                  scratch_pages, count, i;
+  bool                    ok;
+
+  _ctx.pml4  = NULL;
+  _ctx.pages = 0;
+  _ctx.used  = 0;
+  _ctx.pg1g  = check_cpu_pg1g();
+
+  /* Collect RAM ranges, sorted and merged, in scratch pages */
+  scratch_pages = align_page((boot_info->memory_map.count + 1) *
+                             sizeof(memory_range_t)) /
+                  PAGE_SIZE;
+  if ((scratch = pmm_alloc(scratch_pages)) == 0) {
+    return NULL;
+  }
+  ranges = (memory_range_t*)(uintptr_t)scratch;
+
+  count = _add_range(ranges, 0, SIZE_4KB, LOW_MEMORY_END);
+  for (i = 0; i < boot_info->memory_map.count; ++i) {
+    entry = (memory_map_entry const*)(uintptr_t)(
+        boot_info->memory_map.address + i * boot_info->memory_map.entry_size
+    );
+    if (entry->type != MEMORY_USABLE && entry->type != MEMORY_ACPI &&
+        entry->type != MEMORY_NVS) {
+      continue;
+    }
+
+    /* Partly covered pages are mapped whole, page 0 is never mapped */
+    start = entry->base & ~(SIZE_4KB - 1);
+    end   = (entry->base + entry->limit + SIZE_4KB - 1) & ~(SIZE_4KB - 1);
+    if (start < SIZE_4KB) {
+      start = SIZE_4KB;
+    }
+    if (end > MAP_LIMIT) {
+      end = MAP_LIMIT;
+    }
+    count = _add_range(ranges, count, start, end);
+  }
+  count = _merge_ranges(ranges, count);
+
+  /* Tables come from one block, its unused tail is freed afterwards */
+  for (_ctx.pages = 1, i = 0; i < count; ++i) {
+    _ctx.pages += _count_tables(&ranges[i]);
+  }
+  if ((_ctx.tables = pmm_alloc(_ctx.pages)) == 0) {
+    pmm_free(scratch, scratch_pages);
+    return NULL;
+  }
+  _ctx.pml4 = (qword_t*)(uintptr_t)_ctx.tables;
+  _ctx.used = 1;
+  memset(_ctx.pml4, 0, PAGE_SIZE);
+
+  for (ok = true, i = 0; ok && i < count; ++i) {
+    ok = _map(ranges[i].address, ranges[i].address + ranges[i].size);
+  }
+  pmm_free(scratch, scratch_pages);
+  if (!ok) {
+    pmm_free(_ctx.tables, _ctx.pages);
+    _ctx.pml4 = NULL;
+    return NULL;
+  }
+
+  /* Direct map shares PDPTs with identity map */
+  for (i = 0; i < DIRECT_MAP_SLOT; ++i) {
+    _ctx.pml4[DIRECT_MAP_SLOT + i] = _ctx.pml4[i];
+  }
+
+  pmm_free(_ctx.tables + _ctx.used * PAGE_SIZE, _ctx.pages - _ctx.used);
+  _ctx.pages = _ctx.used;
+
+  return _ctx.pml4;
+}
+
+void paging_save_state(boot_info_t* boot_info) {
+  boot_info->paging.pml4       = (qword_t)(uintptr_t)_ctx.pml4;
+  boot_info->paging.direct_map = DIRECT_MAP_BASE;
+  boot_info->paging.pages      = (dword_t)_ctx.pages;
+}
@@ -1,7 +1,10 @@
 #include <bl/io.h>
+#include <bl/module.h>
 #include <bl/pe.h>
-#include <bl/ramfs.h>
+#include <bl/pmm.h>
+#include <bl/stream.h>
 #include <bl/string.h>
+#include <bl/utils.h>
 
 typedef struct __packed dos_header {
   word_t  e_magic;
@@ -101,37 +104,200 @@ typedef struct __packed export_directory {
   dword_t ordinal_table_rva;
 } export_directory;
 
-#define STATES_MAX 16
+typedef struct __packed base_relocation_block {
+  dword_t page_rva;
+  dword_t block_size;
+} base_relocation_block;
+
+/* File header characteristics */
+#define IMAGE_FILE_RELOCS_STRIPPED 0x0001
+
+/* Data directories */
+#define DIRECTORY_EXPORT           0
+#define DIRECTORY_IMPORT           1
+#define DIRECTORY_BASERELOC        5
+
+/* Base relocation types */
+#define IMAGE_REL_BASED_ABSOLUTE   0
+#define IMAGE_REL_BASED_HIGHLOW    3
+#define IMAGE_REL_BASED_DIR64      10
+
+/* Checks if image, packed by mkramfs -a, can be run where it lies in RAMFS.
+ * Each section must be at the same offset in file and in memory, and the
+ * file must be padded to image size */
+static bool _can_run_in_place(
+    void const*           pe_addr,
+    size_t                file_size,
+    pe_header const*      pe_hdr,
+    section_header const* sections,
+    size_t                sections_count
+) {
+  size_t i;
 
-static struct {
-  pe_load_state states[STATES_MAX + 1];
-} _ctx;
+  if ((dword_t)pe_addr % PAGE_SIZE != 0 ||
+      pe_hdr->optional_header.file_alignment !=
+          pe_hdr->optional_header.section_alignment ||
+      pe_hdr->optional_header.section_alignment % PAGE_SIZE != 0 ||
+      file_size < pe_hdr->optional_header.size_of_image) {
+    return false;
+  }
+
+  for (i = 0; i < sections_count; ++i) {
+    if (sections[i].size_of_raw_data != 0 &&
+        sections[i].pointer_to_raw_data != sections[i].virtual_address) {
+      return false;
+    }
+  }
 
-bool pe_loader_init(void* start) {
-  memset(&_ctx, 0, sizeof _ctx);
-  _ctx.states[0].load_addr = (dword_t)start;
   return true;
 }
 
-void pe_get_memory_range(dword_t* begin, dword_t* end) {
-  size_t i;
+/* Checks base relocations before any of them is applied, so a broken table
+ * never leaves image half relocated. Blocks must lie within the directory,
+ * and targets within the image, outside of the directory itself */
+static bool _check_relocs(byte_t const* image, pe_header const* pe_hdr) {
+  data_directoru const* dir =
+      &pe_hdr->optional_header.data_directories[DIRECTORY_BASERELOC];
+  dword_t       image_size = pe_hdr->optional_header.size_of_image;
+  byte_t const* block      = image + dir->virtual_address;
+  byte_t const* end;
+  base_relocation_block const* hdr;
+  word_t const*                entry;
+  word_t const*                entries_end;
+  qword_t                      target;
+  dword_t                      width;
+
+  if (pe_hdr->file_header.characteristics & IMAGE_FILE_RELOCS_STRIPPED ||
+      dir->virtual_address > image_size ||
+      dir->size > image_size - dir->virtual_address) {
+    return false;
+  }
+  end = block + dir->size;
+
+  while (block + sizeof(base_relocation_block) <= end) {
+    hdr = (base_relocation_block const*)block;
+    if (hdr->block_size < sizeof(base_relocation_block) ||
+        hdr->block_size > (dword_t)(end - block)) {
+      return false;
+    }
+
+    entry       = (word_t const*)(hdr + 1);
+    entries_end = (word_t const*)(block + hdr->block_size);
+    for (; entry < entries_end; ++entry) {
+      switch (*entry >> 12) {
+      case IMAGE_REL_BASED_DIR64:    width = sizeof(qword_t); break;
+      case IMAGE_REL_BASED_HIGHLOW:  width = sizeof(dword_t); break;
+      case IMAGE_REL_BASED_ABSOLUTE: width = 0; break;
+      default:                       return false;
+      }
+
+      target = (qword_t)hdr->page_rva + (*entry & 0xFFF);
+      if (width != 0 &&
+          (target + width > image_size ||
+           (target + width > dir->virtual_address &&
+            target < (qword_t)dir->virtual_address + dir->size))) {
+        return false;
+      }
+    }
 
-  if (begin) {
-    *begin = _ctx.states[0].load_addr;
+    block += hdr->block_size;
   }
-  if (end) {
-    for (i = STATES_MAX - 1; i >= 0; --i) {
-      if (_ctx.states[i].load_addr != 0) {
-        *end = _ctx.states[i].load_addr + _ctx.states[i].image_size;
+
+  return true;
+}
+
+/* Apply base relocations for image, loaded delta bytes away from its base.
+ * Nothing is written unless the whole table checks out */
+static bool _relocate(dword_t load_addr, pe_header const* pe_hdr) {
+  data_directoru const* dir =
+      &pe_hdr->optional_header.data_directories[DIRECTORY_BASERELOC];
+  byte_t const* block = (byte_t*)load_addr + dir->virtual_address;
+  byte_t const* end   = block + dir->size;
+  qword_t       delta = load_addr - pe_hdr->optional_header.image_base;
+  base_relocation_block const* hdr;
+  word_t const*                entry;
+  word_t const*                entries_end;
+  byte_t*                      page;
+
+  if (delta == 0) {
+    return true;
+  }
+  if (!_check_relocs((byte_t const*)load_addr, pe_hdr)) {
+    return false;
+  }
+
+  while (block + sizeof(base_relocation_block) <= end) {
+    hdr         = (base_relocation_block const*)block;
+    page        = (byte_t*)load_addr + hdr->page_rva;
+    entry       = (word_t const*)(hdr + 1);
+    entries_end = (word_t const*)(block + hdr->block_size);
+    for (; entry < entries_end; ++entry) {
+      switch (*entry >> 12) {
+      case IMAGE_REL_BASED_DIR64:
+        *(qword_t*)(page + (*entry & 0xFFF)) += delta;
+        break;
+      case IMAGE_REL_BASED_HIGHLOW:
+        *(dword_t*)(page + (*entry & 0xFFF)) += (dword_t)delta;
         break;
+      default: break;
       }
     }
+
+    block += hdr->block_size;
   }
+
+  return true;
 }
 
-bool pe_load(char const* filename, pe_load_state** state) {
-  void*           pe_addr;
-  pe_load_state*  ret;
+/* Find export index by name, trying hint first. Name pointer table is sorted,
+ * so binary search is used otherwise */
+static bool _find_export(
+    dword_t                 dll_addr,
+    export_directory const* export_dir,
+    char const*             name,
+    word_t                  hint,
+    dword_t*                index
+) {
+  dword_t const* name_table =
+      (dword_t const*)(dll_addr + export_dir->name_pointer_rva);
+  word_t const* ordinal_table =
+      (word_t const*)(dll_addr + export_dir->ordinal_table_rva);
+  dword_t low = 0, high = export_dir->number_of_name_pointers, mid;
+  int     cmp;
+
+  if (hint < high && strcmp(name, (char*)dll_addr + name_table[hint]) == 0) {
+    *index = ordinal_table[hint];
+    return true;
+  }
+
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    cmp = strcmp(name, (char*)dll_addr + name_table[mid]);
+    if (cmp == 0) {
+      *index = ordinal_table[mid];
+      return true;
+    } else if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+
+  return false;
+}
+
+bool pe_load(
+    char const*     filename,
+    void*           pe_addr,
+    size_t          file_size,
+    module_info_t** module
+) {
+  size_t          image_pages;
+  size_t          raw_size;
+  bool            relocatable;
+  bool            in_place;
+  dword_t         load_addr;
+  module_info_t*  loaded;
 
   dos_header*     dos_hdr;
   pe_header*      pe_hdr;
@@ -141,29 +307,6 @@ bool pe_load(char const* filename, pe_load_state** state) {
 
   size_t          i;
 
-  /* Check if already loaded */
-  ret = NULL;
-  for (i = 0; i < STATES_MAX; ++i) {
-    size_t name_len = strlen(_ctx.states[i].name);
-    if (name_len == 0) {
-      ret = &_ctx.states[i];
-      break;
-    } else if (!memcmp(_ctx.states[i].name, filename, name_len + 1)) {
-      if (state) {
-        *state = &_ctx.states[i];
-      }
-      return true;
-    }
-  }
-  if (ret == NULL) {
-    return false;
-  }
-
-  /* Open the file */
-  if ((pe_addr = ramfs_file(filename, NULL)) == NULL) {
-    return false;
-  }
-
   /* Verify MZ and PE signatures */
   dos_hdr = pe_addr;
   if (dos_hdr->e_magic != 0x5A4D) {
@@ -182,46 +325,98 @@ bool pe_load(char const* filename, pe_load_state** state) {
   sections       = (section_header*)((byte_t*)&pe_hdr->optional_header +
                                pe_hdr->file_header.size_of_optional_header);
 
-  /* Load headers */
-  memcpy(
-      (void*)ret->load_addr, pe_addr, pe_hdr->optional_header.size_of_headers
-  );
+  /* Images without relocations, which aren't marked as stripped, are
+   * expected to be position independent */
+  relocatable =
+      !(pe_hdr->file_header.characteristics & IMAGE_FILE_RELOCS_STRIPPED);
+  image_pages = align_page(pe_hdr->optional_header.size_of_image) / PAGE_SIZE;
+
+  /* Image, which needs relocation, runs in place only if its whole
+   * relocation table checks out, so RAMFS is never left half patched.
+   * Otherwise it's copied, preferably to its base, where it isn't relocated */
+  if (_can_run_in_place(pe_addr, file_size, pe_hdr, sections, sections_count) &&
+      ((dword_t)pe_addr == pe_hdr->optional_header.image_base ||
+       _check_relocs(pe_addr, pe_hdr))) {
+    /* Image is already laid out, RAMFS is identity mapped, so only BSS tails
+     * need to be cleared */
+    load_addr   = (dword_t)pe_addr;
+    image_pages = 0;
+    in_place    = true;
+  } else {
+    /* Allocate image memory at preferred base, so no relocation is needed,
+     * or anywhere if image can be relocated */
+    if (pe_hdr->optional_header.image_base + image_pages * PAGE_SIZE <=
+            MODULE_ADDRESS_LIMIT &&
+        pmm_alloc_at(pe_hdr->optional_header.image_base, image_pages)) {
+      load_addr = (dword_t)pe_hdr->optional_header.image_base;
+    } else if (!relocatable ||
+               (load_addr = (dword_t)pmm_alloc(image_pages)) == 0) {
+      return false;
+    }
 
-  /* Load sections */
-  for (i = 0; i < sections_count; ++i) {
+    /* Load headers */
     memcpy(
-        (byte_t*)ret->load_addr + sections[i].virtual_address,
-        (char*)pe_addr + sections[i].pointer_to_raw_data,
-        sections[i].size_of_raw_data
+        (void*)load_addr, pe_addr, pe_hdr->optional_header.size_of_headers
     );
+
+    in_place = false;
+  }
+
+  /* Load sections and clear their BSS tails */
+  for (i = 0; i < sections_count; ++i) {
+    raw_size = sections[i].size_of_raw_data;
+    if (sections[i].virtual_size != 0 && raw_size > sections[i].virtual_size) {
+      raw_size = sections[i].virtual_size;
+    }
+
+    if (!in_place && raw_size != 0) {
+      stream_copy(
+          (byte_t*)load_addr + sections[i].virtual_address,
+          (char*)pe_addr + sections[i].pointer_to_raw_data,
+          raw_size
+      );
+    }
+    if (sections[i].virtual_size > raw_size) {
+      module_zero(
+          load_addr + sections[i].virtual_address + raw_size,
+          sections[i].virtual_size - raw_size
+      );
+    }
   }
 
-  /* Fill Load state */
-  snprintf(ret->name, sizeof ret->name, "%s", filename);
-  ret->image_size = (dword_t)pe_hdr->optional_header.size_of_image;
-  ret->entry = ret->load_addr + pe_hdr->optional_header.address_of_entry_point;
-  ret->stack_size = pe_hdr->optional_header.size_of_stack_commit;
+  /* Fix addresses for the actual load address */
+  if (!_relocate(load_addr, pe_hdr)) {
+    pmm_free(load_addr, image_pages);
+    return false;
+  }
 
-  if (ret + 1 - &_ctx.states[0] < STATES_MAX) {
-    (ret + 1)->load_addr = ret->load_addr + ret->image_size;
+  /* Register module before resolving imports, so cyclic imports find it */
+  if ((loaded = module_add(filename)) == NULL) {
+    pmm_free(load_addr, image_pages);
+    return false;
   }
+  loaded->address    = load_addr;
+  loaded->image_size = (dword_t)pe_hdr->optional_header.size_of_image;
+  loaded->stack_size = (dword_t)pe_hdr->optional_header.size_of_stack_commit;
+  loaded->entry =
+      (qword_t)load_addr + pe_hdr->optional_header.address_of_entry_point;
 
   /* Parse import table */
-  if (pe_hdr->optional_header.data_directories[1].size != 0) {
+  if (pe_hdr->optional_header.data_directories[DIRECTORY_IMPORT].size != 0) {
     import_directory* dll_dir;
     /* Go through DLLs */
-    for (dll_dir = (import_directory*)(ret->load_addr + pe_hdr->optional_header
-                                                            .data_directories[1]
-                                                            .virtual_address);
+    for (dll_dir = (import_directory*)(load_addr +
+                                       pe_hdr->optional_header
+                                           .data_directories[DIRECTORY_IMPORT]
+                                           .virtual_address);
          dll_dir->import_lookup_rva != 0;
          ++dll_dir) {
       char              dll_path[256];
-      pe_load_state*    dll;
+      module_info_t*    dll;
+      dword_t           dll_addr;
       pe_header*        dll_pe_hdr;
       export_directory* export_dir;
       dword_t*          export_table;
-      dword_t*          name_table;
-      word_t*           ordinal_table;
       qword_t*          address_table;
 
       /* Load DLL */
@@ -229,80 +424,75 @@ bool pe_load(char const* filename, pe_load_state** state) {
           dll_path,
           sizeof dll_path,
           "ramfs/%s",
-          (char*)(ret->load_addr + dll_dir->name_rva)
+          (char*)(load_addr + dll_dir->name_rva)
       );
-      if (!pe_load(dll_path, &dll)) {
+      if (!module_load(dll_path, &dll)) {
         return false;
       }
+      dll_addr = (dword_t)dll->address;
 
-      /* Get DLL export directory */
-      dll_pe_hdr = (pe_header*)(dll->load_addr +
-                                (((dos_header*)dll->load_addr)->e_lfanew));
-      if (dll_pe_hdr->optional_header.data_directories[0].size == 0) {
+      /* Get DLL export directory, DLL must be a PE image too */
+      if (((dos_header*)dll_addr)->e_magic != 0x5A4D) {
+        return false;
+      }
+      dll_pe_hdr = (pe_header*)(dll_addr + ((dos_header*)dll_addr)->e_lfanew);
+      if (dll_pe_hdr->optional_header.data_directories[DIRECTORY_EXPORT]
+              .size == 0) {
         return false;
       }
-      export_dir =
-          (export_directory*)(dll->load_addr +
-                              dll_pe_hdr->optional_header.data_directories[0]
-                                  .virtual_address);
+      export_dir = (export_directory*)(dll_addr +
+                                       dll_pe_hdr->optional_header
+                                           .data_directories[DIRECTORY_EXPORT]
+                                           .virtual_address);
 
-      /* Get export tables */
+      /* Get export address table */
       export_table =
-          (dword_t*)(dll->load_addr + export_dir->export_address_table_rva);
-      name_table    = (dword_t*)(dll->load_addr + export_dir->name_pointer_rva);
-      ordinal_table = (word_t*)(dll->load_addr + export_dir->ordinal_table_rva);
+          (dword_t*)(dll_addr + export_dir->export_address_table_rva);
 
       /* Go through symbols */
       for (address_table =
-               (qword_t*)(ret->load_addr + dll_dir->import_address_table_rva);
+               (qword_t*)(load_addr + dll_dir->import_address_table_rva);
            *address_table != 0;
            ++address_table) {
+        dword_t export_index;
+
         if (*address_table & (1ULL << 63)) {
-          /* // TODO: Import by ordinal */
-          return false;
+          /* Import by ordinal */
+          export_index = (dword_t)(*address_table & 0xFFFF) -
+                         export_dir->ordinal_base;
         } else {
           /* Import by name */
-          word_t      symbol_index;
+          word_t      symbol_hint;
           char const* symbol_name;
 
-          symbol_index = *(word_t*)(ret->load_addr +
-                                    (dword_t)(*address_table & 0xFFFFFFFF));
-          symbol_name  = (char*)(ret->load_addr +
+          symbol_hint = *(word_t*)(load_addr +
+                                   (dword_t)(*address_table & 0xFFFFFFFF));
+          symbol_name = (char*)(load_addr +
                                 (dword_t)(*address_table & 0xFFFFFFFF) + 2);
 
-          /* Find symbol in export name table */
-          if (!memcmp(
+          if (!_find_export(
+                  dll_addr,
+                  export_dir,
                   symbol_name,
-                  (byte_t*)dll->load_addr + name_table[symbol_index],
-                  strlen(symbol_name) + 1
+                  symbol_hint,
+                  &export_index
               )) {
-            i = symbol_index;
-          } else {
-            bool found = false;
-            for (i = 0; i < export_dir->number_of_name_pointers; ++i) {
-              if (!memcmp(
-                      symbol_name,
-                      (byte_t*)dll->load_addr + name_table[i],
-                      strlen(symbol_name) + 1
-                  )) {
-                found = true;
-                break;
-              }
-            }
-            if (!found) {
-              return false;
-            }
+            return false;
           }
+        }
 
-          /* Bind symbol */
-          *address_table = dll->load_addr + export_table[ordinal_table[i]];
+        /* Bind symbol */
+        if (export_index >= export_dir->address_table_count) {
+          return false;
         }
+        *address_table = dll_addr + export_table[export_index];
       }
     }
   }
 
-  if (state != NULL) {
-    *state = ret;
+  /* Imported modules might have moved module table */
+  if (module != NULL) {
+    *module = module_find(filename);
   }
 
   return true;
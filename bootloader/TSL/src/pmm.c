@@ -0,0 +1,180 @@
+/**
+ * @file pmm.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Physical page allocator
+ *
+ */
+#include <bl/pmm.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Highest page, which can be accessed from TSL */
+#  define PAGES_4GB      0x100000UL
+
+/* Set bit means used page */
+#  define PAGES_PER_WORD 32
+#  define FULL_WORD      0xFFFFFFFFUL
+
+/* Page allocator state */
+static struct {
+  dword_t  address;
+  dword_t* bitmap;
+  dword_t  pages;
+  dword_t  free_pages;
+  dword_t  alloc_limit;
+  dword_t  hint; /* There are no free pages below */
+} _pmm_ctx;
+
+static bool _is_used(dword_t page) {
+  return (_pmm_ctx.bitmap[page / PAGES_PER_WORD] >> (page % PAGES_PER_WORD)) &
+         1;
+}
+
+/* Mark pages as used or free, keeping count of free pages */
+static void _mark(dword_t page, dword_t count, bool used) {
+  dword_t* word;
+  dword_t  mask;
+
+  while (count != 0) {
+    word = &_pmm_ctx.bitmap[page / PAGES_PER_WORD];
+
+    if (page % PAGES_PER_WORD == 0 && count >= PAGES_PER_WORD &&
+        *word == (used ? 0 : FULL_WORD)) {
+      /* Whole word changes */
+      if (used) {
+        *word                = FULL_WORD;
+        _pmm_ctx.free_pages -= PAGES_PER_WORD;
+      } else {
+        *word                = 0;
+        _pmm_ctx.free_pages += PAGES_PER_WORD;
+      }
+      page  += PAGES_PER_WORD;
+      count -= PAGES_PER_WORD;
+      continue;
+    }
+
+    mask = 1UL << (page % PAGES_PER_WORD);
+    if (used && !(*word & mask)) {
+      *word |= mask;
+      --_pmm_ctx.free_pages;
+    } else if (!used && (*word & mask)) {
+      *word &= ~mask;
+      ++_pmm_ctx.free_pages;
+    }
+    ++page;
+    --count;
+  }
+}
+
+#endif /* DOX_SKIP */
+
+bool pmm_init(boot_info_t const* boot_info) {
+  qword_t pages = boot_info->pmm.pages;
+
+  if (boot_info->pmm.bitmap == 0 || boot_info->pmm.bitmap >> 32 != 0 ||
+      pages == 0 || pages >> 32 != 0) {
+    return false;
+  }
+
+  /* Continue with the state, built by SSL */
+  _pmm_ctx.address     = (dword_t)boot_info->pmm.bitmap;
+  _pmm_ctx.bitmap      = (dword_t*)(uintptr_t)_pmm_ctx.address;
+  _pmm_ctx.pages       = (dword_t)pages;
+  _pmm_ctx.free_pages  = (dword_t)boot_info->pmm.free_pages;
+  _pmm_ctx.hint        = 0;
+  _pmm_ctx.alloc_limit = _pmm_ctx.pages < PAGES_4GB ? _pmm_ctx.pages
+                                                     : PAGES_4GB;
+
+  return true;
+}
+
+void pmm_reserve(qword_t address, qword_t size) {
+  qword_t first = address / PAGE_SIZE;
+  qword_t end   = (address + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  if (end > _pmm_ctx.pages) {
+    end = _pmm_ctx.pages;
+  }
+  if (first < end) {
+    _mark((dword_t)first, (dword_t)(end - first), true);
+  }
+}
+
+qword_t pmm_alloc(size_t count) {
+  dword_t page, start, run;
+
+  if (count == 0 || count > _pmm_ctx.free_pages) {
+    return 0;
+  }
+
+  /* First fit, skipping fully used words */
+  start = run = 0;
+  for (page = _pmm_ctx.hint; page < _pmm_ctx.alloc_limit;) {
+    if (page % PAGES_PER_WORD == 0 &&
+        _pmm_ctx.bitmap[page / PAGES_PER_WORD] == FULL_WORD) {
+      run   = 0;
+      page += PAGES_PER_WORD;
+      continue;
+    }
+
+    if (_is_used(page)) {
+      run = 0;
+    } else {
+      if (run++ == 0) {
+        start = page;
+      }
+      if (run == count) {
+        _mark(start, count, true);
+        if (start == _pmm_ctx.hint) {
+          _pmm_ctx.hint = start + count;
+        }
+        return (qword_t)start * PAGE_SIZE;
+      }
+    }
+    ++page;
+  }
+
+  return 0;
+}
+
+bool pmm_alloc_at(qword_t address, size_t count) {
+  dword_t page, i;
+
+  if (address % PAGE_SIZE != 0 || address / PAGE_SIZE >= _pmm_ctx.alloc_limit ||
+      count == 0 || count > _pmm_ctx.alloc_limit - address / PAGE_SIZE) {
+    return false;
+  }
+
+  page = (dword_t)(address / PAGE_SIZE);
+  for (i = 0; i < count; ++i) {
+    if (_is_used(page + i)) {
+      return false;
+    }
+  }
+
+  _mark(page, count, true);
+  return true;
+}
+
+void pmm_free(qword_t address, size_t count) {
+  dword_t page = (dword_t)(address / PAGE_SIZE);
+
+  if (page >= _pmm_ctx.pages || count == 0) {
+    return;
+  }
+  if (count > _pmm_ctx.pages - page) {
+    count = _pmm_ctx.pages - page;
+  }
+
+  _mark(page, count, false);
+  if (page < _pmm_ctx.hint) {
+    _pmm_ctx.hint = page;
+  }
+}
+
+void pmm_save_state(boot_info_t* boot_info) {
+  boot_info->pmm.bitmap     = _pmm_ctx.address;
+  boot_info->pmm.pages      = _pmm_ctx.pages;
+  boot_info->pmm.free_pages = _pmm_ctx.free_pages;
+}
@@ -5,26 +5,100 @@
  *
  */
 
+#include <bl/crc32.h>
+#include <bl/io.h>
+#include <bl/log.h>
+#include <bl/pmm.h>
 #include <bl/ramfs.h>
+#include <bl/sha256.h>
 #include <bl/string.h>
-
-static struct {
-  void*  addr;
-  size_t size;
-} _ctx;
+#include <bl/utils.h>
 
 typedef struct posix_header {
   char name[100];
   char _unused0[24];
   char size[12];
-  char _unused1[121];
+  char _unused1[20];
+  char typeflag;
+  char _unused2[100];
   char magic[6];
-  char _unused2[249];
+  char _unused3[249];
 } posix_header;
 
-static size_t _str_oct_to_dec(char const* oct) {
+/* Index entry, empty if hdr is NULL */
+typedef struct index_entry {
+  dword_t       hash;
+  dword_t       size;
+  posix_header* hdr;
+} index_entry;
+
+/* Index, precomputed by mkramfs, must match tools/mkramfs/mkramfs.c */
+#define PACKED_INDEX_NAME    "ramfs/.index"
+#define PACKED_INDEX_MAGIC   0x58444952UL /* "RIDX" */
+#define PACKED_INDEX_VERSION 1
+
+/* Index flags */
+#define PACKED_INDEX_CRC32   0x1 /* Entries carry CRC32 of file data */
+
+typedef struct __packed packed_index {
+  dword_t magic;
+  dword_t version;
+  dword_t count;
+  dword_t flags;
+} packed_index;
+
+/* Sorted by hash, offset is of file data from RAMFS start */
+typedef struct __packed packed_entry {
+  dword_t hash;
+  dword_t offset;
+  dword_t size;
+  dword_t crc32;
+} packed_entry;
+
+/* Manifest, written by mkramfs right after the index */
+#define MANIFEST_NAME    "ramfs/.manifest"
+#define MANIFEST_MAGIC   0x464E4D52UL /* "RMNF" */
+#define MANIFEST_VERSION 1
+
+/* Merkle leaves follow the header in the order of index entries */
+typedef struct __packed manifest {
+  dword_t magic;
+  dword_t version;
+  dword_t count;
+  dword_t reserved;
+  byte_t  root[SHA256_SIZE];
+} manifest;
+
+/* First byte of hashed data tells leaves from inner nodes */
+#define MERKLE_LEAF 0x00
+#define MERKLE_NODE 0x01
+
+#ifdef RAMFS_ROOT_HASH
+/* Trusted Merkle root, TSL is built with it */
+static byte_t const _root_hash[SHA256_SIZE] = { RAMFS_ROOT_HASH };
+#endif
+
+static struct {
+  void*               addr;
+  size_t              size;
+  index_entry*        index;
+  dword_t             index_mask;
+  packed_entry const* packed;
+  dword_t             packed_count;
+  dword_t             packed_flags;
+  byte_t const*       leaves;   /* Manifest leaves, NULL if none */
+  byte_t*             verified; /* Bitmap of checked index entries */
+} _ctx;
+
+/* FNV-1a parameters */
+#define FNV_OFFSET_BASIS 0x811C9DC5UL
+#define FNV_PRIME        0x01000193UL
+
+static size_t _str_oct_to_dec(char const* oct, size_t len) {
   size_t ret = 0;
-  while (*oct != 0) { ret = ret * 8 + *oct++ - '0'; }
+  while (len-- != 0 && '0' <= *oct && *oct <= '7') {
+    ret = ret * 8 + *oct++ - '0';
+  }
   return ret;
 }
 
@@ -32,19 +106,327 @@ static size_t        _align512(size_t val) { return (val + 511) & -512; }
 
 static posix_header* _next(posix_header* hdr) {
   return (posix_header*)((byte_t*)(hdr + 1) +
-                         _align512(_str_oct_to_dec(hdr->size)));
+                         _align512(_str_oct_to_dec(hdr->size, 12)));
+}
+
+static bool _is_regular(posix_header const* hdr) {
+  return hdr->typeflag == '0' || hdr->typeflag == '\0';
+}
+
+/* Hash file name, stored name may fill the whole field without NUL */
+static dword_t _hash(char const* name, size_t max_len) {
+  dword_t hash = FNV_OFFSET_BASIS;
+  while (max_len-- != 0 && *name != '\0') {
+    hash = (hash ^ (byte_t)*name++) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static bool _name_equal(posix_header const* hdr, char const* name) {
+  size_t i;
+  for (i = 0; i < sizeof hdr->name; ++i) {
+    if (hdr->name[i] != name[i]) {
+      return false;
+    }
+    if (name[i] == '\0') {
+      return true;
+    }
+  }
+  return name[i] == '\0';
+}
+
+/* Use index member, written by mkramfs, if RAMFS starts with it */
+static bool _use_packed_index(void) {
+  posix_header*       hdr   = _ctx.addr;
+  packed_index const* index = (packed_index const*)(hdr + 1);
+  size_t              index_size, i;
+
+  if (_ctx.size < 2 * sizeof(posix_header) ||
+      memcmp("ustar", hdr->magic, 5) != 0 || !_is_regular(hdr) ||
+      !_name_equal(hdr, PACKED_INDEX_NAME)) {
+    return false;
+  }
+
+  index_size = _str_oct_to_dec(hdr->size, sizeof hdr->size);
+  if (index_size < sizeof(packed_index) ||
+      sizeof(posix_header) + index_size > _ctx.size ||
+      index->magic != PACKED_INDEX_MAGIC ||
+      index->version != PACKED_INDEX_VERSION ||
+      (index_size - sizeof(packed_index)) / sizeof(packed_entry) <
+          index->count) {
+    return false;
+  }
+
+  /* Only the index is checked, the archive isn't touched */
+  _ctx.packed = (packed_entry const*)(index + 1);
+  for (i = 0; i < index->count; ++i) {
+    if (_ctx.packed[i].offset < 2 * sizeof(posix_header) ||
+        _ctx.packed[i].offset > _ctx.size ||
+        _ctx.packed[i].size > _ctx.size - _ctx.packed[i].offset ||
+        (i != 0 && _ctx.packed[i - 1].hash > _ctx.packed[i].hash)) {
+      _ctx.packed = NULL;
+      return false;
+    }
+  }
+  _ctx.packed_count = index->count;
+  _ctx.packed_flags = index->flags;
+
+  return true;
+}
+
+/* Check file data on the first lookup only, images run in place change it
+ * afterwards */
+static bool _verify_packed(dword_t entry, char const* name, void const* data) {
+  byte_t   tag = MERKLE_LEAF;
+  byte_t   leaf[SHA256_SIZE];
+  size_t   size = _ctx.packed[entry].size;
+  sha256_t sha;
+
+  if (_ctx.verified == NULL ||
+      (_ctx.verified[entry / 8] & (1 << entry % 8)) != 0) {
+    return true;
+  }
+
+  if ((_ctx.packed_flags & PACKED_INDEX_CRC32) != 0 &&
+      crc32_update(0, data, size) != _ctx.packed[entry].crc32) {
+    log_printf(LOG_ERROR, "RAMFS file %s is corrupted.\n", name);
+    return false;
+  }
+
+  /* Leaf covers the name too, so files can't be swapped */
+  if (_ctx.leaves != NULL) {
+    sha256_start(&sha);
+    sha256_update(&sha, &tag, 1);
+    sha256_update(&sha, name, strlen(name) + 1);
+    sha256_update(&sha, data, size);
+    sha256_finish(&sha, leaf);
+    if (memcmp(leaf, _ctx.leaves + entry * SHA256_SIZE, SHA256_SIZE) != 0) {
+      log_printf(LOG_ERROR, "RAMFS file %s doesn't match manifest.\n", name);
+      return false;
+    }
+  }
+
+  _ctx.verified[entry / 8] |= 1 << entry % 8;
+  return true;
 }
 
-bool ramfs_init(void* address) {
+/* Binary search in the index, written by mkramfs */
+static void* _find_packed(char const* name, size_t* size) {
+  dword_t       hash = _hash(name, SIZE_MAX);
+  dword_t       low = 0, high = _ctx.packed_count, mid;
+  posix_header* hdr;
+
+  /* Find the first entry with the hash */
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (_ctx.packed[mid].hash < hash) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  /* Compare names of all entries with the hash */
+  for (; low < _ctx.packed_count && _ctx.packed[low].hash == hash; ++low) {
+    hdr = (posix_header*)((byte_t*)_ctx.addr + _ctx.packed[low].offset) - 1;
+    if (!_name_equal(hdr, name)) {
+      continue;
+    }
+
+    if (!_verify_packed(low, name, hdr + 1)) {
+      return NULL;
+    }
+
+    if (size != NULL) {
+      *size = _ctx.packed[low].size;
+    }
+    return hdr + 1;
+  }
+
+  return NULL;
+}
+
+static void
+_merkle_node(byte_t* node, byte_t const* left, byte_t const* right) {
+  byte_t   tag = MERKLE_NODE;
+  sha256_t sha;
+
+  sha256_start(&sha);
+  sha256_update(&sha, &tag, 1);
+  sha256_update(&sha, left, SHA256_SIZE);
+  sha256_update(&sha, right, SHA256_SIZE);
+  sha256_finish(&sha, node);
+}
+
+/* Fold leaves level by level in scratch pages, odd node goes to the next
+ * level as is */
+static bool _merkle_root(byte_t const* leaves, dword_t count, byte_t* root) {
+  size_t        pages;
+  qword_t       scratch;
+  byte_t*       level;
+  byte_t const* nodes = leaves;
+  dword_t       i;
+
+  if (count == 0) {
+    return false;
+  }
+  if (count == 1) {
+    memcpy(root, leaves, SHA256_SIZE);
+    return true;
+  }
+
+  pages = align_page((count + 1) / 2 * SHA256_SIZE) / PAGE_SIZE;
+  if ((scratch = pmm_alloc(pages)) == 0) {
+    return false;
+  }
+  level = (byte_t*)(uintptr_t)scratch;
+
+  for (; count > 1; count = (count + 1) / 2, nodes = level) {
+    for (i = 0; i + 1 < count; i += 2) {
+      _merkle_node(
+          level + i / 2 * SHA256_SIZE, nodes + i * SHA256_SIZE,
+          nodes + (i + 1) * SHA256_SIZE
+      );
+    }
+    if (count % 2 != 0) {
+      memcpy(
+          level + count / 2 * SHA256_SIZE, nodes + (count - 1) * SHA256_SIZE,
+          SHA256_SIZE
+      );
+    }
+  }
+  memcpy(root, level, SHA256_SIZE);
+
+  pmm_free(scratch, pages);
+  return true;
+}
+
+/* Use manifest, written by mkramfs right after the index. Its leaves must
+ * add up to its root, and to the trusted one, if TSL is built with it */
+static bool _use_manifest(void) {
+  posix_header*   hdr = _next(_ctx.addr);
+  manifest const* man = (manifest const*)(hdr + 1);
+  byte_t          root[SHA256_SIZE];
+  size_t          offset, size;
+
+  offset = (byte_t*)man - (byte_t*)_ctx.addr;
+  if (offset > _ctx.size || memcmp("ustar", hdr->magic, 5) != 0 ||
+      !_is_regular(hdr) || !_name_equal(hdr, MANIFEST_NAME)) {
+#ifdef RAMFS_ROOT_HASH
+    log_printf(LOG_ERROR, "RAMFS has no manifest.\n");
+    return false;
+#else
+    return true;
+#endif
+  }
+
+  size = _str_oct_to_dec(hdr->size, sizeof hdr->size);
+  if (size < sizeof(manifest) || size > _ctx.size - offset ||
+      man->magic != MANIFEST_MAGIC || man->version != MANIFEST_VERSION ||
+      man->count != _ctx.packed_count ||
+      (size - sizeof(manifest)) / SHA256_SIZE < man->count) {
+    log_printf(LOG_ERROR, "RAMFS manifest is malformed.\n");
+    return false;
+  }
+
+  if (!_merkle_root((byte_t const*)(man + 1), man->count, root)) {
+    log_printf(LOG_ERROR, "Failed to check RAMFS manifest.\n");
+    return false;
+  }
+  if (memcmp(root, man->root, SHA256_SIZE) != 0) {
+    log_printf(LOG_ERROR, "RAMFS manifest is corrupted.\n");
+    return false;
+  }
+#ifdef RAMFS_ROOT_HASH
+  if (memcmp(root, _root_hash, SHA256_SIZE) != 0) {
+    log_printf(LOG_ERROR, "RAMFS manifest isn't trusted.\n");
+    return false;
+  }
+#endif
+
+  _ctx.leaves = (byte_t const*)(man + 1);
+  return true;
+}
+
+/* Build open addressing index, so lookups don't walk the archive */
+static void _build_index(posix_header* end, size_t files) {
   posix_header* i;
+  dword_t       capacity, slot, hash;
+
+  /* Keep load factor at most 1/2 */
+  for (capacity = 16; capacity < files * 2; capacity *= 2) { continue; }
+  _ctx.index = (index_entry*)(uintptr_t)pmm_alloc(
+      align_page(capacity * sizeof(index_entry)) / PAGE_SIZE
+  );
+  if (_ctx.index == NULL) {
+    /* Lookups will walk the archive */
+    return;
+  }
+  memset(_ctx.index, 0, capacity * sizeof(index_entry));
+  _ctx.index_mask = capacity - 1;
+
+  for (i = _ctx.addr; i < end; i = _next(i)) {
+    if (!_is_regular(i)) {
+      continue;
+    }
+
+    hash = _hash(i->name, sizeof i->name);
+    for (slot = hash & _ctx.index_mask; _ctx.index[slot].hdr != NULL;
+         slot = (slot + 1) & _ctx.index_mask) {
+      continue;
+    }
+    _ctx.index[slot].hash = hash;
+    _ctx.index[slot].size = _str_oct_to_dec(i->size, sizeof i->size);
+    _ctx.index[slot].hdr  = i;
+  }
+}
+
+bool ramfs_init(void* address, size_t size) {
+  posix_header* i;
+  posix_header* end   = (posix_header*)((byte_t*)address + size);
+  size_t        files = 0;
   /* Set RAMFS base address */
-  _ctx.addr = address;
+  _ctx.addr           = address;
+  _ctx.size           = size;
+  _ctx.index          = NULL;
+  _ctx.packed         = NULL;
+  _ctx.leaves         = NULL;
+  _ctx.verified       = NULL;
+
+  /* Archives, packed by mkramfs, need no scan */
+  if (_use_packed_index()) {
+    if (!_use_manifest()) {
+      return false;
+    }
+
+    /* Files are checked once, remember which ones */
+    if ((_ctx.packed_flags & PACKED_INDEX_CRC32) != 0 || _ctx.leaves != NULL) {
+      _ctx.verified = (byte_t*)(uintptr_t)pmm_alloc(
+          align_page(_ctx.packed_count / 8 + 1) / PAGE_SIZE
+      );
+      if (_ctx.verified == NULL) {
+        return false;
+      }
+      memset(_ctx.verified, 0, _ctx.packed_count / 8 + 1);
+    }
+    return true;
+  }
+
+#ifdef RAMFS_ROOT_HASH
+  /* Only archives with manifest may be trusted */
+  log_printf(LOG_ERROR, "RAMFS has no manifest.\n");
+  return false;
+#endif
 
   /* Get RAMFS size */
-  for (i = _ctx.addr; memcmp("ustar", i->magic, 5) == 0; i = _next(i))
-    ;
+  for (i = _ctx.addr; i < end && memcmp("ustar", i->magic, 5) == 0;
+       i = _next(i)) {
+    files += _is_regular(i);
+  }
   _ctx.size = (char*)i - (char*)_ctx.addr;
 
+  _build_index(i, files);
+
   return true;
 }
 
@@ -52,10 +434,33 @@ void* ramfs_get_end(void) { return (byte_t*)_ctx.addr + _ctx.size; }
 
 void* ramfs_file(char const* name, size_t* size) {
   posix_header* hdr;
-  for (hdr = _ctx.addr; memcmp("ustar", hdr->magic, 5) == 0; hdr = _next(hdr)) {
-    if (memcmp(hdr->name, name, strlen(name)) == 0) {
+  posix_header* end = (posix_header*)((byte_t*)_ctx.addr + _ctx.size);
+  dword_t       hash, slot;
+
+  if (_ctx.packed != NULL) {
+    return _find_packed(name, size);
+  }
+
+  if (_ctx.index != NULL) {
+    /* Duplicates are inserted in archive order, so the first one wins */
+    hash = _hash(name, SIZE_MAX);
+    for (slot = hash & _ctx.index_mask; _ctx.index[slot].hdr != NULL;
+         slot = (slot + 1) & _ctx.index_mask) {
+      if (_ctx.index[slot].hash == hash &&
+          _name_equal(_ctx.index[slot].hdr, name)) {
+        if (size != NULL) {
+          *size = _ctx.index[slot].size;
+        }
+        return _ctx.index[slot].hdr + 1;
+      }
+    }
+    return NULL;
+  }
+
+  for (hdr = _ctx.addr; hdr < end; hdr = _next(hdr)) {
+    if (_is_regular(hdr) && _name_equal(hdr, name)) {
       if (size != NULL) {
-        *size = _str_oct_to_dec(hdr->size);
+        *size = _str_oct_to_dec(hdr->size, sizeof hdr->size);
       }
       return hdr + 1;
     }
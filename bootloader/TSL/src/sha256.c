@@ -0,0 +1,255 @@
+/**
+ * @file sha256.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief SHA-256 hash
+ * @details Built with SSE registers allowed, for SHA extensions
+ *
+ */
+#include <bl/sha256.h>
+#include <bl/stream.h>
+#include <bl/string.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+#  define BLOCK_SIZE 64
+
+/* Round constants */
+static dword_t const _k[64] = {
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+  0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+  0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+  0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+  0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+  0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+  0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+  0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+  0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+/* PSHUFB mask, swapping bytes of each dword */
+static dword_t const _bswap[4] = { 0x00010203, 0x04050607, 0x08090A0B,
+                                   0x0C0D0E0F };
+
+static struct {
+  bool sha_ni;
+} _ctx;
+
+/* Scalar rounds, unrolled by 8 so that variables rotate by renaming */
+#  define ROR(x, n)        (((x) >> (n)) | ((x) << (32 - (n))))
+#  define SIGMA0(x)        (ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#  define SIGMA1(x)        (ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#  define GAMMA0(x)        (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#  define GAMMA1(x)        (ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+#  define CH(x, y, z)      ((z) ^ ((x) & ((y) ^ (z))))
+#  define MAJ(x, y, z)     (((x) & (y)) | ((z) & ((x) | (y))))
+
+#  define LOAD(i)                                                           \
+    (w[i] = (dword_t)data[(i) * 4] << 24 | (dword_t)data[(i) * 4 + 1] << 16 | \
+            (dword_t)data[(i) * 4 + 2] << 8 | data[(i) * 4 + 3])
+#  define EXPAND(i)                                                       \
+    (w[(i) & 15] += GAMMA1(w[((i) + 14) & 15]) + w[((i) + 9) & 15] +      \
+                    GAMMA0(w[((i) + 1) & 15]))
+
+#  define ROUND(a, b, c, d, e, f, g, h, i, word)                         \
+    t  = h + SIGMA1(e) + CH(e, f, g) + _k[i] + (word);                   \
+    d += t;                                                              \
+    h  = t + SIGMA0(a) + MAJ(a, b, c)
+
+#  define ROUNDS8(i, W)                                \
+    ROUND(a, b, c, d, e, f, g, h, (i) + 0, W((i) + 0)); \
+    ROUND(h, a, b, c, d, e, f, g, (i) + 1, W((i) + 1)); \
+    ROUND(g, h, a, b, c, d, e, f, (i) + 2, W((i) + 2)); \
+    ROUND(f, g, h, a, b, c, d, e, (i) + 3, W((i) + 3)); \
+    ROUND(e, f, g, h, a, b, c, d, (i) + 4, W((i) + 4)); \
+    ROUND(d, e, f, g, h, a, b, c, (i) + 5, W((i) + 5)); \
+    ROUND(c, d, e, f, g, h, a, b, (i) + 6, W((i) + 6)); \
+    ROUND(b, c, d, e, f, g, h, a, (i) + 7, W((i) + 7))
+
+static void _blocks_scalar(dword_t* state, byte_t const* data, size_t count) {
+  dword_t a, b, c, d, e, f, g, h, t;
+  dword_t w[16];
+  size_t  i;
+
+  for (; count != 0; --count, data += BLOCK_SIZE) {
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    ROUNDS8(0, LOAD);
+    ROUNDS8(8, LOAD);
+    for (i = 16; i < 64; i += 8) { ROUNDS8(i, EXPAND); }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+/* SHA extensions keep state as ABEF in XMM1 and CDGH in XMM2, message
+ * schedule rotates through XMM3-XMM6. XMM0 is implicit SHA256RNDS2 operand */
+#  define STR(x)           #x
+#  define ROUNDS4(i, m)                            \
+    "movdqu " STR(i) "*16(%[k]), %%xmm0\n"          \
+    "paddd %%" m ", %%xmm0\n"                       \
+    "sha256rnds2 %%xmm0, %%xmm1, %%xmm2\n"          \
+    "pshufd $0x0E, %%xmm0, %%xmm0\n"                \
+    "sha256rnds2 %%xmm0, %%xmm2, %%xmm1\n"
+#  define SCHEDULE(i, m0, m1, m2, m3)              \
+    "sha256msg1 %%" m1 ", %%" m0 "\n"               \
+    "movdqa %%" m3 ", %%xmm7\n"                     \
+    "palignr $4, %%" m2 ", %%xmm7\n"                \
+    "paddd %%xmm7, %%" m0 "\n"                      \
+    "sha256msg2 %%" m3 ", %%" m0 "\n" ROUNDS4(i, m0)
+#  define LOAD4(i, m)                              \
+    "movdqu " STR(i) "*16(%[data]), %%" m "\n"      \
+    "pshufb %%xmm7, %%" m "\n" ROUNDS4(i, m)
+
+static void _blocks_ni(dword_t* state, byte_t const* data, size_t count) {
+  dword_t save[8];
+
+  __asm__ volatile(
+      /* Reorder state words for SHA256RNDS2 */
+      "movdqu (%[state]), %%xmm7\n"
+      "movdqu 16(%[state]), %%xmm2\n"
+      "pshufd $0xB1, %%xmm7, %%xmm7\n"
+      "pshufd $0x1B, %%xmm2, %%xmm2\n"
+      "movdqa %%xmm7, %%xmm1\n"
+      "palignr $8, %%xmm2, %%xmm1\n"
+      "pblendw $0xF0, %%xmm7, %%xmm2\n"
+
+      "1:\n"
+      "movdqu %%xmm1, (%[save])\n"
+      "movdqu %%xmm2, 16(%[save])\n"
+      "movdqu %[bswap], %%xmm7\n"
+      LOAD4(0, "xmm3")
+      LOAD4(1, "xmm4")
+      LOAD4(2, "xmm5")
+      LOAD4(3, "xmm6")
+      SCHEDULE(4, "xmm3", "xmm4", "xmm5", "xmm6")
+      SCHEDULE(5, "xmm4", "xmm5", "xmm6", "xmm3")
+      SCHEDULE(6, "xmm5", "xmm6", "xmm3", "xmm4")
+      SCHEDULE(7, "xmm6", "xmm3", "xmm4", "xmm5")
+      SCHEDULE(8, "xmm3", "xmm4", "xmm5", "xmm6")
+      SCHEDULE(9, "xmm4", "xmm5", "xmm6", "xmm3")
+      SCHEDULE(10, "xmm5", "xmm6", "xmm3", "xmm4")
+      SCHEDULE(11, "xmm6", "xmm3", "xmm4", "xmm5")
+      SCHEDULE(12, "xmm3", "xmm4", "xmm5", "xmm6")
+      SCHEDULE(13, "xmm4", "xmm5", "xmm6", "xmm3")
+      SCHEDULE(14, "xmm5", "xmm6", "xmm3", "xmm4")
+      SCHEDULE(15, "xmm6", "xmm3", "xmm4", "xmm5")
+      "movdqu (%[save]), %%xmm7\n"
+      "paddd %%xmm7, %%xmm1\n"
+      "movdqu 16(%[save]), %%xmm7\n"
+      "paddd %%xmm7, %%xmm2\n"
+      "addl $64, %[data]\n"
+      "decl %[count]\n"
+      "jnz 1b\n"
+
+      /* Put state words back in order */
+      "pshufd $0x1B, %%xmm1, %%xmm7\n"
+      "pshufd $0xB1, %%xmm2, %%xmm2\n"
+      "movdqa %%xmm7, %%xmm1\n"
+      "pblendw $0xF0, %%xmm2, %%xmm1\n"
+      "palignr $8, %%xmm7, %%xmm2\n"
+      "movdqu %%xmm1, (%[state])\n"
+      "movdqu %%xmm2, 16(%[state])"
+      : [data] "+r"(data), [count] "+r"(count)
+      : [state] "r"(state),
+        [save] "r"(save),
+        [k] "r"(_k),
+        [bswap] "m"(_bswap)
+      : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+        "cc", "memory"
+  );
+}
+
+static void _blocks(dword_t* state, byte_t const* data, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (_ctx.sha_ni && stream_has_sse()) {
+    _blocks_ni(state, data, count);
+  } else {
+    _blocks_scalar(state, data, count);
+  }
+}
+
+#endif /* DOX_SKIP */
+
+void sha256_init(void) { _ctx.sha_ni = check_cpu_sha(); }
+
+void sha256_start(sha256_t* ctx) {
+  ctx->state[0] = 0x6A09E667;
+  ctx->state[1] = 0xBB67AE85;
+  ctx->state[2] = 0x3C6EF372;
+  ctx->state[3] = 0xA54FF53A;
+  ctx->state[4] = 0x510E527F;
+  ctx->state[5] = 0x9B05688C;
+  ctx->state[6] = 0x1F83D9AB;
+  ctx->state[7] = 0x5BE0CD19;
+  ctx->length   = 0;
+}
+
+void sha256_update(sha256_t* ctx, void const* buf, size_t len) {
+  byte_t const* data = buf;
+  size_t        used = (size_t)(ctx->length % BLOCK_SIZE);
+  size_t        part;
+
+  ctx->length += len;
+
+  /* Complete buffered block first */
+  if (used != 0) {
+    part = BLOCK_SIZE - used < len ? BLOCK_SIZE - used : len;
+    memcpy(ctx->block + used, data, part);
+    data += part;
+    len  -= part;
+    if (used + part < BLOCK_SIZE) {
+      return;
+    }
+    _blocks(ctx->state, ctx->block, 1);
+  }
+
+  /* Hash whole blocks in place and buffer the rest */
+  _blocks(ctx->state, data, len / BLOCK_SIZE);
+  data += len - len % BLOCK_SIZE;
+  memcpy(ctx->block, data, len % BLOCK_SIZE);
+}
+
+void sha256_finish(sha256_t* ctx, byte_t* digest) {
+  size_t  used = (size_t)(ctx->length % BLOCK_SIZE);
+  qword_t bits = ctx->length * 8;
+  size_t  i;
+
+  ctx->block[used++] = 0x80;
+  if (used > BLOCK_SIZE - 8) {
+    memset(ctx->block + used, 0, BLOCK_SIZE - used);
+    _blocks(ctx->state, ctx->block, 1);
+    used = 0;
+  }
+  memset(ctx->block + used, 0, BLOCK_SIZE - 8 - used);
+  for (i = 0; i < 8; ++i) {
+    ctx->block[BLOCK_SIZE - 1 - i] = (byte_t)(bits >> (i * 8));
+  }
+  _blocks(ctx->state, ctx->block, 1);
+
+  for (i = 0; i < 8; ++i) {
+    digest[i * 4]     = (byte_t)(ctx->state[i] >> 24);
+    digest[i * 4 + 1] = (byte_t)(ctx->state[i] >> 16);
+    digest[i * 4 + 2] = (byte_t)(ctx->state[i] >> 8);
+    digest[i * 4 + 3] = (byte_t)ctx->state[i];
+  }
+}
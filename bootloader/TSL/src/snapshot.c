@@ -0,0 +1,179 @@
+/**
+ * @file snapshot.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Prelinked boot snapshot
+ *
+ */
+#include <bl/crc32.h>
+#include <bl/io.h>
+#include <bl/log.h>
+#include <bl/module.h>
+#include <bl/pmm.h>
+#include <bl/ramfs.h>
+#include <bl/snapshot.h>
+#include <bl/stream.h>
+#include <bl/string.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Must match tools/mksnapshot/mksnapshot.c */
+#  define SNAPSHOT_NAME    "ramfs/.snapshot"
+#  define SNAPSHOT_MAGIC   0x504E5356UL /* "VSNP" */
+#  define SNAPSHOT_VERSION 2
+
+typedef struct __packed snapshot_header {
+  dword_t magic;
+  dword_t version;
+  dword_t checksum;    /* CRC32 of module names and files */
+  dword_t count;       /* Count of modules, kernel is the first one */
+  qword_t base;        /* Physical address snapshot is linked for */
+  dword_t image_size;  /* Size of snapshot in memory */
+  dword_t data_offset; /* Offset of image data in file */
+  dword_t data_size;   /* Size of image data, the rest is zeroed */
+  dword_t rsv;
+} snapshot_header;
+
+typedef struct __packed snapshot_module {
+  dword_t name;        /* Offset of NUL-terminated name in file */
+  dword_t offset;      /* Offset of module from snapshot base */
+  dword_t image_size;
+  dword_t entry;       /* Offset of entry point from snapshot base */
+  dword_t stack_size;
+  dword_t file_size;   /* Size of module file, as it was made from */
+} snapshot_module;
+
+/* Continue checksum with module name and whole file, as they are in RAMFS.
+ * File may only be followed by zero padding, added by mkramfs -a */
+static bool
+_hash_module(char const* name, dword_t file_size, dword_t* checksum) {
+  byte_t const* file;
+  size_t        size;
+  size_t        i;
+
+  if ((file = ramfs_file(name, &size)) == NULL || size < file_size) {
+    return false;
+  }
+  for (i = file_size; i < size; ++i) {
+    if (file[i] != 0) {
+      return false;
+    }
+  }
+
+  *checksum = crc32_update(*checksum, name, strlen(name) + 1);
+  *checksum = crc32_update(*checksum, file, file_size);
+  return true;
+}
+
+/* Check snapshot layout, so it can be trusted further. Names lie between
+ * module records and image data, which is preceded by zero padding. Entry
+ * point of each module must lie within the module */
+static bool _is_valid(snapshot_header const* hdr, size_t size) {
+  snapshot_module const* modules = (snapshot_module const*)(hdr + 1);
+  size_t                 names;
+  size_t                 i;
+
+  if (size < sizeof(snapshot_header) || hdr->magic != SNAPSHOT_MAGIC ||
+      hdr->version != SNAPSHOT_VERSION || hdr->count == 0 ||
+      hdr->count > (size - sizeof(snapshot_header)) / sizeof(snapshot_module)) {
+    return false;
+  }
+
+  names = sizeof(snapshot_header) + hdr->count * sizeof(snapshot_module);
+  if (hdr->data_offset <= names || hdr->data_offset > size ||
+      ((byte_t const*)hdr)[hdr->data_offset - 1] != '\0' ||
+      hdr->data_size > size - hdr->data_offset ||
+      hdr->data_size > hdr->image_size) {
+    return false;
+  }
+
+  for (i = 0; i < hdr->count; ++i) {
+    if (modules[i].name < names || modules[i].name >= hdr->data_offset ||
+        modules[i].offset > hdr->image_size ||
+        modules[i].image_size > hdr->image_size - modules[i].offset ||
+        modules[i].entry < modules[i].offset ||
+        modules[i].entry - modules[i].offset >= modules[i].image_size) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#endif /* DOX_SKIP */
+
+bool snapshot_load(char const* filename, module_info_t** module) {
+  snapshot_header const* hdr;
+  snapshot_module const* modules;
+  module_info_t*         loaded;
+  size_t                 size;
+  size_t                 pages;
+  dword_t                checksum = 0;
+  dword_t                base;
+  size_t                 count;
+  size_t                 i;
+
+  if ((hdr = ramfs_file(SNAPSHOT_NAME, &size)) == NULL) {
+    return false;
+  }
+  modules = (snapshot_module const*)(hdr + 1);
+  if (!_is_valid(hdr, size)) {
+    log_printf(LOG_WARN, "Boot snapshot is malformed, ignoring it.\n");
+    return false;
+  }
+  if (strcmp((char const*)hdr + modules[0].name, filename) != 0) {
+    return false;
+  }
+
+  /* Snapshot is outdated if any of its inputs changed */
+  for (i = 0; i < hdr->count; ++i) {
+    if (!_hash_module(
+            (char const*)hdr + modules[i].name, modules[i].file_size, &checksum
+        )) {
+      break;
+    }
+  }
+  if (i != hdr->count || checksum != hdr->checksum) {
+    log_printf(LOG_INFO, "Boot snapshot is outdated, ignoring it.\n");
+    return false;
+  }
+
+  /* Snapshot is linked for fixed address */
+  base  = (dword_t)hdr->base;
+  pages = align_page(hdr->image_size) / PAGE_SIZE;
+  if (hdr->base + hdr->image_size > MODULE_ADDRESS_LIMIT ||
+      !pmm_alloc_at(base, pages)) {
+    log_printf(
+        LOG_WARN,
+        "Boot snapshot can't be placed at 0x%llx, ignoring it.\n",
+        hdr->base
+    );
+    return false;
+  }
+
+  /* Records are added first, so nothing is left behind if it fails */
+  for (count = module_count(), i = 0; i < hdr->count; ++i) {
+    if ((loaded = module_add((char const*)hdr + modules[i].name)) == NULL) {
+      module_truncate(count);
+      pmm_free(base, pages);
+      log_printf(LOG_WARN, "Boot snapshot can't be registered, ignoring it.\n");
+      return false;
+    }
+    loaded->address    = base + modules[i].offset;
+    loaded->entry      = base + modules[i].entry;
+    loaded->image_size = modules[i].image_size;
+    loaded->stack_size = modules[i].stack_size;
+  }
+
+  stream_copy(
+      (void*)base, (byte_t const*)hdr + hdr->data_offset, hdr->data_size
+  );
+  module_zero(base + hdr->data_size, hdr->image_size - hdr->data_size);
+
+  if (module != NULL) {
+    *module = module_find(filename);
+  }
+
+  return true;
+}
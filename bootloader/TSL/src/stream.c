@@ -0,0 +1,197 @@
+/**
+ * @file stream.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Non-temporal copy of large buffers
+ * @details Built with SSE registers allowed
+ *
+ */
+#include <bl/pmm.h>
+#include <bl/stream.h>
+#include <bl/string.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Control register bits */
+#  define CR0_MP            (1UL << 1)
+#  define CR0_EM            (1UL << 2)
+#  define CR0_TS            (1UL << 3)
+#  define CR4_OSFXSR        (1UL << 9)
+#  define CR4_OSXMMEXCPT    (1UL << 10)
+#  define CR0_MASK          (CR0_MP | CR0_EM | CR0_TS)
+#  define CR4_MASK          (CR4_OSFXSR | CR4_OSXMMEXCPT)
+
+/* Bytes moved by one iteration of streaming loop */
+#  define BLOCK_SIZE        64
+
+/* Calibration tries sizes from the smallest up to the largest one */
+#  define CALIBRATION_MIN   0x4000
+#  define CALIBRATION_PAGES 256
+
+/* Used if there's no TSC or scratch memory to calibrate */
+#  define DEFAULT_THRESHOLD 0x40000
+
+static struct {
+  bool    enabled;
+  dword_t cr0;       /* Original CR0_MASK bits */
+  dword_t cr4;       /* Original CR4_MASK bits */
+  size_t  threshold; /* Copies of this size and above are streamed */
+} _ctx;
+
+static dword_t _read_cr0(void) {
+  dword_t value;
+  __asm__ volatile("movl %%cr0, %[value]" : [value] "=r"(value));
+  return value;
+}
+
+static void _write_cr0(dword_t value) {
+  __asm__ volatile("movl %[value], %%cr0" : : [value] "r"(value));
+}
+
+static dword_t _read_cr4(void) {
+  dword_t value;
+  __asm__ volatile("movl %%cr4, %[value]" : [value] "=r"(value));
+  return value;
+}
+
+static void _write_cr4(dword_t value) {
+  __asm__ volatile("movl %[value], %%cr4" : : [value] "r"(value));
+}
+
+static qword_t _rdtsc(void) {
+  qword_t tsc;
+  __asm__ volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/* Stream whole blocks to 16-byte aligned destination */
+static void _stream(byte_t* dest, byte_t const* src, size_t blocks) {
+  __asm__ volatile(
+      "1:\n"
+      "movdqu (%[src]), %%xmm0\n"
+      "movdqu 16(%[src]), %%xmm1\n"
+      "movdqu 32(%[src]), %%xmm2\n"
+      "movdqu 48(%[src]), %%xmm3\n"
+      "movntdq %%xmm0, (%[dest])\n"
+      "movntdq %%xmm1, 16(%[dest])\n"
+      "movntdq %%xmm2, 32(%[dest])\n"
+      "movntdq %%xmm3, 48(%[dest])\n"
+      "addl $64, %[src]\n"
+      "addl $64, %[dest]\n"
+      "decl %[blocks]\n"
+      "jnz 1b\n"
+      "sfence"
+      : [dest] "+r"(dest), [src] "+r"(src), [blocks] "+r"(blocks)
+      :
+      : "xmm0", "xmm1", "xmm2", "xmm3", "cc", "memory"
+  );
+}
+
+/* Find the smallest size, at which streaming is not slower than memcpy */
+static size_t _calibrate(void) {
+  size_t  limit = CALIBRATION_PAGES * PAGE_SIZE;
+  qword_t buffer;
+  byte_t* src;
+  byte_t* dest;
+  qword_t start, regular, streamed;
+  size_t  size;
+
+  if (!check_cpu_tsc() ||
+      (buffer = pmm_alloc(CALIBRATION_PAGES * 2)) == 0) {
+    return DEFAULT_THRESHOLD;
+  }
+  src  = (byte_t*)(uintptr_t)buffer;
+  dest = src + limit;
+
+  for (size = CALIBRATION_MIN; size <= limit; size *= 2) {
+    /* Both copies start with source in cache */
+    memcpy(dest, src, size);
+
+    start    = _rdtsc();
+    _stream(dest, src, size / BLOCK_SIZE);
+    streamed = _rdtsc() - start;
+
+    start    = _rdtsc();
+    memcpy(dest, src, size);
+    regular  = _rdtsc() - start;
+
+    if (streamed <= regular) {
+      break;
+    }
+  }
+
+  pmm_free(buffer, CALIBRATION_PAGES * 2);
+  return size;
+}
+
+#endif /* DOX_SKIP */
+
+void stream_init(void) {
+  dword_t cr0, cr4;
+
+  _ctx.enabled = false;
+  if (!check_cpu_sse2()) {
+    return;
+  }
+
+  cr0      = _read_cr0();
+  cr4      = _read_cr4();
+  _ctx.cr0 = cr0 & CR0_MASK;
+  _ctx.cr4 = cr4 & CR4_MASK;
+  _write_cr0((cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP);
+  _write_cr4(cr4 | CR4_MASK);
+
+  _ctx.threshold = _calibrate();
+  _ctx.enabled   = true;
+}
+
+void* stream_copy(void* dest, void const* src, size_t count) {
+  byte_t*       d = dest;
+  byte_t const* s = src;
+  size_t        head;
+
+  if (!_ctx.enabled || count < _ctx.threshold) {
+    return memcpy(dest, src, count);
+  }
+
+  /* Align destination, stream blocks, then copy the tail */
+  head = -(uintptr_t)d % 16;
+  memcpy(d, s, head);
+  d     += head;
+  s     += head;
+  count -= head;
+
+  _stream(d, s, count / BLOCK_SIZE);
+  d += count - count % BLOCK_SIZE;
+  s += count - count % BLOCK_SIZE;
+  memcpy(d, s, count % BLOCK_SIZE);
+
+  return dest;
+}
+
+bool stream_has_sse(void) { return _ctx.enabled; }
+
+void stream_fini(void) {
+  if (!_ctx.enabled) {
+    return;
+  }
+
+  __asm__ volatile(
+      "pxor %%xmm0, %%xmm0\n"
+      "pxor %%xmm1, %%xmm1\n"
+      "pxor %%xmm2, %%xmm2\n"
+      "pxor %%xmm3, %%xmm3\n"
+      "pxor %%xmm4, %%xmm4\n"
+      "pxor %%xmm5, %%xmm5\n"
+      "pxor %%xmm6, %%xmm6\n"
+      "pxor %%xmm7, %%xmm7"
+      :
+      :
+      : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+  );
+  _write_cr4((_read_cr4() & ~CR4_MASK) | _ctx.cr4);
+  _write_cr0((_read_cr0() & ~CR0_MASK) | _ctx.cr0);
+
+  _ctx.enabled = false;
+}
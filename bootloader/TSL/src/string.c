@@ -5,33 +5,138 @@
  *
  */
 #include <bl/string.h>
+#include <bl/utils.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Below this size byte string instructions are slow without FSRM */
+#  define ERMS_THRESHOLD 128
+
+/* Checks dword for a zero byte */
+#  define HAS_ZERO(x)    (((x) - 0x01010101UL) & ~(x) & 0x80808080UL)
+
+static struct {
+  size_t movsb_threshold; /* Copies of this size and above use REP MOVSB */
+  size_t stosb_threshold; /* Fills of this size and above use REP STOSB */
+} _ctx = { ~(size_t)0, ~(size_t)0 };
+
+#endif /* DOX_SKIP */
+
+void string_init(void) {
+  bool erms = check_cpu_erms();
+
+  /* Fall back to dword string instructions without ERMSB */
+  _ctx.stosb_threshold = erms ? ERMS_THRESHOLD : ~(size_t)0;
+  _ctx.movsb_threshold = check_cpu_fsrm() ? 0 : _ctx.stosb_threshold;
+}
 
 size_t strlen(char const* start) {
-  char const* end;
-  for (end = start; *end != '\0'; ++end)
+  char const*    end = start;
+  dword_t const* word;
+
+  /* Align, so reading by dwords never crosses into the next page */
+  for (; (uintptr_t)end % sizeof(dword_t) != 0; ++end) {
+    if (*end == '\0') {
+      return end - start;
+    }
+  }
+  for (word = (dword_t const*)end; !HAS_ZERO(*word); ++word)
+    ;
+  for (end = (char const*)word; *end != '\0'; ++end)
     ;
   return end - start;
 }
 
+int strcmp(char const* lhs, char const* rhs) {
+  while (*lhs != '\0' && *lhs == *rhs) {
+    ++lhs;
+    ++rhs;
+  }
+  return (byte_t)*lhs - (byte_t)*rhs;
+}
+
 int memcmp(void const* lhs, void const* rhs, size_t count) {
-  while (count--) {
-    if (*(byte_t*)lhs != *(byte_t*)rhs) {
-      return (uintptr_t)lhs - (uintptr_t)rhs;
+  byte_t const* l = lhs;
+  byte_t const* r = rhs;
+
+  /* Skip equal dwords, then find the differing byte */
+  for (; count >= sizeof(dword_t); count -= sizeof(dword_t)) {
+    if (*(dword_t const*)l != *(dword_t const*)r) {
+      break;
     }
-    lhs = (byte_t*)lhs + 1;
-    rhs = (byte_t*)rhs + 1;
+    l += sizeof(dword_t);
+    r += sizeof(dword_t);
+  }
+  for (; count != 0; --count) {
+    if (*l != *r) {
+      return *l - *r;
+    }
+    ++l;
+    ++r;
   }
   return 0;
 }
 
 void* memcpy(void* dest, void const* src, size_t count) {
-  size_t i;
-  for (i = 0; i < count; ++i) { ((byte_t*)dest)[i] = ((byte_t*)src)[i]; }
+  void*       d = dest;
+  void const* s = src;
+  size_t      head;
+
+  if (count >= _ctx.movsb_threshold) {
+    __asm__ volatile("rep movsb"
+                     : "+D"(d), "+S"(s), "+c"(count)
+                     :
+                     : "memory");
+    return dest;
+  }
+
+  /* Align destination, copy by dwords, then the tail */
+  head = count < sizeof(dword_t) ? count : -(uintptr_t)dest % sizeof(dword_t);
+  count -= head;
+  __asm__ volatile(
+      "rep movsb\n"
+      "movl %[dwords], %%ecx\n"
+      "rep movsl\n"
+      "movl %[tail], %%ecx\n"
+      "rep movsb"
+      : "+D"(d), "+S"(s), "+c"(head)
+      : [dwords] "r"(count / sizeof(dword_t)),
+        [tail] "r"(count % sizeof(dword_t))
+      : "memory"
+  );
+
   return dest;
 }
 
 void* memset(void* ptr, int val, size_t count) {
-  byte_t* data = (byte_t*)ptr;
-  while (count--) { *data++ = (byte_t)val; }
+  void*   d       = ptr;
+  dword_t pattern = (byte_t)val * 0x01010101UL;
+  size_t  head;
+
+  if (count >= _ctx.stosb_threshold) {
+    __asm__ volatile("rep stosb"
+                     : "+D"(d), "+c"(count)
+                     : "a"(pattern)
+                     : "memory");
+    return ptr;
+  }
+
+  /* Align destination, fill by dwords, then the tail */
+  head = count < sizeof(dword_t) ? count : -(uintptr_t)ptr % sizeof(dword_t);
+  count -= head;
+  __asm__ volatile(
+      "rep stosb\n"
+      "movl %[dwords], %%ecx\n"
+      "rep stosl\n"
+      "movl %[tail], %%ecx\n"
+      "rep stosb"
+      : "+D"(d), "+c"(head)
+      : "a"(pattern),
+        [dwords] "r"(count / sizeof(dword_t)),
+        [tail] "r"(count % sizeof(dword_t))
+      : "memory"
+  );
+
   return ptr;
 }
@@ -4,26 +4,28 @@
  * @brief Third Stage Loader entry
  *
  */
+#include <bl/crc32.h>
 #include <bl/defines.h>
 #include <bl/io.h>
-#include <bl/pe.h>
+#include <bl/log.h>
+#include <bl/module.h>
+#include <bl/paging.h>
+#include <bl/pmm.h>
 #include <bl/ramfs.h>
+#include <bl/sha256.h>
+#include <bl/snapshot.h>
+#include <bl/stream.h>
 #include <bl/string.h>
 #include <bl/types.h>
 #include <bl/utils.h>
 
-static qword_t pml4[512] __align(1 << 12);
-static qword_t pml3[512] __align(1 << 12);
-static qword_t pml2[512] __align(1 << 12);
-static qword_t pml1[512] __align(1 << 12);
-
 /**
  * @brief Print error message to screen
  *
  * @param error_str Error message
  */
-static void    print_error(char const* error_str) {
-  serial_printf("VLGBL Error: %s.\n", error_str);
+static void print_error(char const* error_str) {
+  log_printf(LOG_ERROR, "VLGBL Error: %s.\n", error_str);
 }
 
 /**
@@ -35,74 +37,81 @@ static void    print_error(char const* error_str) {
  */
 void __stdcall __noreturn tsl_entry(boot_info_t* boot_info) {
   size_t         i;
-  pe_load_state* kernel;
-  dword_t        pe_memory_end;
+  module_info_t* kernel;
+  dword_t        stack;
+  qword_t*       pml4;
+
+  /* Pick string routines for this CPU, they carry all copies below */
+  string_init();
 
-  /* Verify boot info size */
+  /* Verify boot info size, boot log can't be located in outdated one */
   if (boot_info->size != sizeof(boot_info_t)) {
+    (void)log_init(0); /* Report to serial only */
     print_error("Boot info is outdated");
     goto halt;
   }
 
+  /* Continue boot log */
+  (void)log_init(boot_info->boot_log.address);
+
   /* Disable all PCI devices */
   disable_pci();
 
+  /* Continue with page allocator, built by SSL */
+  if (!pmm_init(boot_info)) {
+    print_error("Failed to initialize page allocator");
+    goto halt;
+  }
+
+  /* Enable streaming copy of loaded images */
+  stream_init();
+
+  /* Build CRC32 tables and pick SHA-256, RAMFS files are verified with them */
+  crc32_init();
+  sha256_init();
+
   /* Initialize RAMFS driver */
-  if (!ramfs_init((void*)(uintptr_t)boot_info->RAMFS.address)) {
+  if (!ramfs_init(
+          (void*)(uintptr_t)boot_info->RAMFS.address,
+          (size_t)boot_info->RAMFS.size
+      )) {
     print_error("Failed to initialize RAMFS");
     goto halt;
   }
 
-  /* Initialize PE loader */
-  if (!pe_loader_init((void*)align_page((dword_t)ramfs_get_end()))) {
-    print_error("Failed to initialize PE loader");
+  /* Initialize module loader */
+  if (!module_loader_init()) {
+    print_error("Failed to initialize module loader");
     goto halt;
   }
 
-  /* Load kernel image */
-  if (!pe_load("ramfs/kernel.pe", &kernel)) {
+  /* Load kernel image, prelinked snapshot is tried first. Name has no
+   * extension, as kernel may be either PE or ELF */
+  if (!snapshot_load("ramfs/kernel", &kernel) &&
+      !module_load("ramfs/kernel", &kernel)) {
     print_error("Failed to load kernel image");
     goto halt;
   }
 
-  /* Enable Physical Address Extension */
-  enable_PAE();
-
-  /* Clear page tables */
-  memset(pml4, 0, sizeof pml4);
-  memset(pml3, 0, sizeof pml3);
-  memset(pml2, 0, sizeof pml2);
-  memset(pml1, 0, sizeof pml1);
+  /* Hand module table over to kernel */
+  module_save_state(boot_info);
 
-  /* Identity map SSL */
-  for (i = 0; i < 16; ++i) {
-    qword_t addr     = 0x10000 + (i << 12);
-    pml1[addr >> 12] = addr | 0x1;
-  }
-
-  /* Identity map TSL */
-  for (i = 0; i < 16; ++i) {
-    qword_t addr     = 0x20000 + (i << 12);
-    pml1[addr >> 12] = addr | 0x1;
+  /* Allocate temporary stack */
+  if ((stack = (dword_t)pmm_alloc(align_page(kernel->stack_size) / PAGE_SIZE)
+      ) == 0) {
+    print_error("Failed to allocate kernel stack");
+    goto halt;
   }
 
-  /* Identity map RAMFS and kernel image */
-  pe_get_memory_range(NULL, &pe_memory_end);
-  pe_memory_end = align_page(pe_memory_end);
-  for (i = boot_info->RAMFS.address >> 12; i < pe_memory_end >> 12; ++i) {
-    pml1[i] = (i << 12) | 0x1;
-  }
+  /* Enable Physical Address Extension */
+  enable_PAE();
 
-  /* Identity map temporary stack */
-  for (i = 0; i < align_page(kernel->stack_size) >> 12; ++i) {
-    qword_t addr     = pe_memory_end + (i << 12);
-    pml1[addr >> 12] = addr | 0x1;
+  /* Map all RAM for kernel */
+  if ((pml4 = paging_build(boot_info)) == NULL) {
+    print_error("Failed to build page tables");
+    goto halt;
   }
 
-  pml2[0] = (qword_t)(uintptr_t)pml1 | 0x3;
-  pml3[0] = (qword_t)(uintptr_t)pml2 | 0x3;
-  pml4[0] = (qword_t)(uintptr_t)pml3 | 0x3;
-
   /* Find ACPI RSDP table*/
   for (i = 0xE0000; i < 0xFFFFF; ++i) {
     if (!memcmp((void*)i, "RSD PTR ", 8)) {
@@ -114,6 +123,13 @@ void __stdcall __noreturn tsl_entry(boot_info_t* boot_info) {
   }
   boot_info->ACPI.rsdp = i;
 
+  /* Hand page tables and page allocator over to kernel */
+  paging_save_state(boot_info);
+  pmm_save_state(boot_info);
+
+  /* Kernel gets FPU and SSE in the state SSL left them */
+  stream_fini();
+
   /* Load page table */
   load_page_table(pml4);
 
@@ -123,7 +139,8 @@ void __stdcall __noreturn tsl_entry(boot_info_t* boot_info) {
   /* Enable Paging */
   enable_paging();
 
-  /* Finalize TSL */
+  /* Finalize TSL. Boot info is passed in RCX for PE kernels (Microsoft x64
+   * ABI) and in RDI for ELF kernels (System V ABI) */
   __asm__ volatile(
       "pushw %[segment]\n"
       "pushl %[offset]\n"
@@ -131,13 +148,15 @@ void __stdcall __noreturn tsl_entry(boot_info_t* boot_info) {
 
       "movl %[tmp_stack], %%esp\n"
       "movl %[bootinfo], %%ecx\n"
+      "movl %%ecx, %%edi\n"
 
       "lcall *(%%ebp)"
       :
       : [segment] "rmN"((word_t)3 << 3),
         [offset] "rm"((dword_t)kernel->entry),
         [bootinfo] "rmN"((dword_t)boot_info),
-        [tmp_stack] "rmN"((dword_t)pe_memory_end + kernel->stack_size)
+        [tmp_stack] "rmN"(stack + kernel->stack_size)
+      : "ecx", "edi"
   );
 
 halt:
@@ -85,15 +85,19 @@ static void _cpuid(dword_t* eax, dword_t* ebx, dword_t* ecx, dword_t* edx) {
 
 /* CPUID EAX = 1: EDX */
 #define CPUID_PSE     (1 << 3)
+#define CPUID_TSC     (1 << 4)
 #define CPUID_MSR     (1 << 5)
 #define CPUID_PAE     (1 << 6)
 #define CPUID_APIC    (1 << 9)
 #define CPUID_PGE     (1 << 13)
 #define CPUID_PAT     (1 << 16)
 #define CPUID_ACPI    (1 << 22)
+#define CPUID_SSE2    (1 << 26)
 
 /* CPUID EAX = 1: ECX */
 #define CPUID_SSE3    (1 << 0)
+#define CPUID_PCLMUL  (1 << 1)
+#define CPUID_SSSE3   (1 << 9)
 #define CPUID_SSE41   (1 << 19)
 #define CPUID_SSE42   (1 << 20)
 #define CPUID_x2APIC  (1 << 21)
@@ -105,6 +109,30 @@ static void _cpuid(dword_t* eax, dword_t* ebx, dword_t* ecx, dword_t* edx) {
 #define CPUID_PG1G    (1 << 26)
 #define CPUID_LM      (1 << 29)
 
+/* CPUID EAX = 7, ECX = 0: EBX */
+#define CPUID_ERMS    (1 << 9)
+#define CPUID_SHA     (1 << 29)
+
+/* CPUID EAX = 7, ECX = 0: EDX */
+#define CPUID_FSRM    (1 << 4)
+
+/* Query structured extended features, zeroes if CPU doesn't report them */
+static void _cpuid_ext_features(dword_t* ebx, dword_t* edx) {
+  dword_t eax, ecx;
+
+  eax = 0;
+  _cpuid(&eax, ebx, &ecx, edx);
+  if (eax < 7) {
+    *ebx = 0;
+    *edx = 0;
+    return;
+  }
+
+  __asm__("cpuid"
+          : "=a"(eax), "=b"(*ebx), "=c"(ecx), "=d"(*edx)
+          : "a"(7), "c"(0));
+}
+
 bool check_cpu_compat(void) {
   dword_t eax, ebx, ecx, edx;
   dword_t cpuid_max, cpuid_ext_max;
@@ -136,6 +164,69 @@ bool check_cpu_compat(void) {
   return true;
 }
 
+bool check_cpu_sse2(void) {
+  dword_t eax, ebx, ecx, edx;
+
+  eax = 1;
+  _cpuid(&eax, &ebx, &ecx, &edx);
+  return (edx & CPUID_SSE2) != 0;
+}
+
+bool check_cpu_pclmul(void) {
+  dword_t eax, ebx, ecx, edx;
+
+  eax = 1;
+  _cpuid(&eax, &ebx, &ecx, &edx);
+  return (ecx & CPUID_PCLMUL) != 0;
+}
+
+bool check_cpu_tsc(void) {
+  dword_t eax, ebx, ecx, edx;
+
+  eax = 1;
+  _cpuid(&eax, &ebx, &ecx, &edx);
+  return (edx & CPUID_TSC) != 0;
+}
+
+bool check_cpu_pg1g(void) {
+  dword_t eax, ebx, ecx, edx;
+
+  eax = 0x80000000;
+  _cpuid(&eax, &ebx, &ecx, &edx);
+  if (eax < 0x80000001) {
+    return false;
+  }
+
+  eax = 0x80000001;
+  _cpuid(&eax, &ebx, &ecx, &edx);
+  return (edx & CPUID_PG1G) != 0;
+}
+
+bool check_cpu_erms(void) {
+  dword_t ebx, edx;
+  _cpuid_ext_features(&ebx, &edx);
+  return (ebx & CPUID_ERMS) != 0;
+}
+
+bool check_cpu_fsrm(void) {
+  dword_t ebx, edx;
+  _cpuid_ext_features(&ebx, &edx);
+  return (edx & CPUID_FSRM) != 0;
+}
+
+bool check_cpu_sha(void) {
+  dword_t eax, ebx, ecx, edx;
+
+  eax = 1;
+  _cpuid(&eax, &ebx, &ecx, &edx);
+  if ((ecx & (CPUID_SSSE3 | CPUID_SSE41)) != (CPUID_SSSE3 | CPUID_SSE41)) {
+    return false;
+  }
+
+  _cpuid_ext_features(&ebx, &edx);
+  return (ebx & CPUID_SHA) != 0;
+}
+
 void enable_PAE(void) {
   __asm__ volatile(
       "movl %%cr4, %%eax\n"
@@ -2,3 +2,5 @@
 set(OUTPUT "${CMAKE_BINARY_DIR}/out" CACHE PATH "Bootloader targets directory")
 option(BUILD_DOCS "Build documentation (requires doxygen)" OFF)
 set(OUTPUT_DOCS "${OUTPUT}/docs" CACHE PATH "Documentation directory")
+set(PE_DEFER_ZERO_THRESHOLD 0 CACHE STRING "Minimal size of PE BSS tail, left for kernel to zero (0 disables)")
+set(RAMFS_ROOT_HASH "" CACHE STRING "Trusted Merkle root of RAMFS manifest, 64 hex digits (empty disables)")
@@ -24,4 +24,5 @@ function(import_VolgaBL)
     set(VOLGABL_MBR ${ARG_PATH}/out/bootloader_mbr PARENT_SCOPE)
     set(VOLGABL_SSL ${ARG_PATH}/out/bootloader_ssl PARENT_SCOPE)
     set(VOLGABL_TSL ${ARG_PATH}/out/bootloader_tsl PARENT_SCOPE)
+    set(VOLGABL_MKRAMFS ${ARG_PATH}/out/mkramfs PARENT_SCOPE)
 endfunction(import_VolgaBL)
@@ -0,0 +1,89 @@
+/**
+ * @file crcpatch.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Host tool for filling CRC32 of bootloader images
+ * @details Image starts with a 5-byte jump, followed by header, which the
+ * linker script puts there: magic, image size and CRC32 field. CRC32 of the
+ * image, counted with the field being zero, is written to the field. SSL
+ * checks it before running the image
+ *
+ * Usage: crcpatch <image>
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+/* Must match SSL/include/bl/defines.h */
+#  define IMAGE_MAGIC         0x474D4956UL /* "VIMG" */
+#  define IMAGE_HEADER_OFFSET 5
+#  define IMAGE_HEADER_SIZE   12
+#  define IMAGE_MAX_SIZE      0x10000
+#  define CRC32_POLY          0xEDB88320UL
+
+static uint32_t _get32(unsigned char const* buf) {
+  return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 |
+         (uint32_t)buf[3] << 24;
+}
+
+static void _put32(unsigned char* buf, uint32_t val) {
+  buf[0] = (unsigned char)val;
+  buf[1] = (unsigned char)(val >> 8);
+  buf[2] = (unsigned char)(val >> 16);
+  buf[3] = (unsigned char)(val >> 24);
+}
+
+static uint32_t _crc32(unsigned char const* buf, size_t len) {
+  uint32_t crc = 0xFFFFFFFFUL;
+  int      i;
+
+  while (len-- != 0) {
+    crc ^= *buf++;
+    for (i = 0; i < 8; ++i) { crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1)); }
+  }
+  return ~crc;
+}
+
+#endif /* DOX_SKIP */
+
+int main(int argc, char** argv) {
+  static unsigned char image[IMAGE_MAX_SIZE + 1];
+  unsigned char*       hdr = image + IMAGE_HEADER_OFFSET;
+  size_t               len;
+  uint32_t             size;
+  FILE*                file;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: crcpatch <image>\n");
+    return EXIT_FAILURE;
+  }
+
+  if ((file = fopen(argv[1], "r+b")) == NULL) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  len = fread(image, 1, sizeof image, file);
+
+  size = _get32(hdr + 4);
+  if (len < IMAGE_HEADER_OFFSET + IMAGE_HEADER_SIZE ||
+      _get32(hdr) != IMAGE_MAGIC || size > len || size > IMAGE_MAX_SIZE ||
+      size < IMAGE_HEADER_OFFSET + IMAGE_HEADER_SIZE) {
+    fprintf(stderr, "crcpatch: %s has no valid image header\n", argv[1]);
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+
+  _put32(hdr + 8, 0);
+  _put32(hdr + 8, _crc32(image, size));
+  if (fseek(file, IMAGE_HEADER_OFFSET + 8, SEEK_SET) != 0 ||
+      fwrite(hdr + 8, 4, 1, file) != 1) {
+    fprintf(stderr, "crcpatch: failed to write %s\n", argv[1]);
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+
+  return fclose(file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
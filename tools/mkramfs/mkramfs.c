@@ -0,0 +1,656 @@
+/**
+ * @file mkramfs.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Host tool for packing RAMFS archives
+ * @details Writes ustar archive, which starts with `ramfs/.index` member.
+ * The index holds name hashes of all other members, sorted, with offsets
+ * and sizes of their data, so TSL finds files without walking the archive.
+ * The archive can still be read by any tar
+ *
+ * With -a, data of each file starts on a 4KB boundary, padding goes to pax
+ * comments, which tar ignores. PE images with equal file and section
+ * alignment and ELF64 images with segments at the same offsets in file and in
+ * memory are also padded with zeros to their size in memory, so TSL can run
+ * them in place
+ *
+ * With -c, the index also holds CRC32 of data of each file, TSL checks it
+ * when the file is looked up first time
+ *
+ * With -m, `ramfs/.manifest` member follows the index. It holds SHA-256 of
+ * name and data of each file, in the order of index entries, as leaves of
+ * Merkle tree, and the tree root, which is also printed. TSL checks the
+ * leaves against the root at startup, and each file against its leaf when
+ * it's looked up first time
+ *
+ * Usage: mkramfs [-a] [-c] [-m] -o <archive> <file>...
+ * Files are stored under the names they are given with
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+#  define BLOCK_SIZE       512
+#  define PAGE_SIZE        4096
+
+/* Must match TSL/src/ramfs.c */
+#  define INDEX_NAME       "ramfs/.index"
+#  define INDEX_MAGIC      0x58444952UL /* "RIDX" */
+#  define INDEX_VERSION    1
+#  define INDEX_CRC32      0x1
+#  define MANIFEST_NAME    "ramfs/.manifest"
+#  define MANIFEST_MAGIC   0x464E4D52UL /* "RMNF" */
+#  define MANIFEST_VERSION 1
+#  define MERKLE_LEAF      0x00
+#  define MERKLE_NODE      0x01
+#  define SHA256_SIZE      32
+#  define FNV_OFFSET_BASIS 0x811C9DC5UL
+#  define FNV_PRIME        0x01000193UL
+#  define CRC32_POLY       0xEDB88320UL
+
+typedef struct member {
+  char const*   name;
+  uint32_t      hash;
+  uint32_t      offset;
+  uint32_t      size;
+  uint32_t      file_size;         /* Rest of size is zero padding */
+  uint32_t      pad;               /* Padding before header */
+  uint32_t      crc;               /* CRC32 of data with zero padding */
+  unsigned char leaf[SHA256_SIZE]; /* Merkle leaf of name and data */
+} member;
+
+typedef struct sha256 {
+  uint32_t      state[8];
+  uint64_t      length;
+  unsigned char block[64];
+} sha256;
+
+static uint32_t _hash(char const* name) {
+  uint32_t hash = FNV_OFFSET_BASIS;
+  while (*name != '\0') {
+    hash = (hash ^ (unsigned char)*name++) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static uint32_t _align512(uint32_t val) { return (val + 511) & ~511UL; }
+
+static uint32_t _get16(unsigned char const* buf) {
+  return (uint32_t)buf[0] | (uint32_t)buf[1] << 8;
+}
+
+static uint32_t _get32(unsigned char const* buf) {
+  return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 |
+         (uint32_t)buf[3] << 24;
+}
+
+static uint64_t _get64(unsigned char const* buf) {
+  return (uint64_t)_get32(buf) | (uint64_t)_get32(buf + 4) << 32;
+}
+
+static void _put32(unsigned char* buf, uint32_t val) {
+  buf[0] = (unsigned char)val;
+  buf[1] = (unsigned char)(val >> 8);
+  buf[2] = (unsigned char)(val >> 16);
+  buf[3] = (unsigned char)(val >> 24);
+}
+
+static uint32_t const _sha256_k[64] = {
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+  0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+  0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+  0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+  0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+  0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+  0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+  0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+  0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static uint32_t _ror(uint32_t val, int n) {
+  return (val >> n) | (val << (32 - n));
+}
+
+static void _sha256_block(sha256* ctx, unsigned char const* data) {
+  uint32_t w[64], v[8], t1, t2;
+  int      i;
+
+  for (i = 0; i < 16; ++i) {
+    w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+           (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+  }
+  for (i = 16; i < 64; ++i) {
+    w[i] = w[i - 16] + w[i - 7] +
+           (_ror(w[i - 15], 7) ^ _ror(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+           (_ror(w[i - 2], 17) ^ _ror(w[i - 2], 19) ^ (w[i - 2] >> 10));
+  }
+
+  memcpy(v, ctx->state, sizeof v);
+  for (i = 0; i < 64; ++i) {
+    t1   = v[7] + (_ror(v[4], 6) ^ _ror(v[4], 11) ^ _ror(v[4], 25)) +
+           (v[6] ^ (v[4] & (v[5] ^ v[6]))) + _sha256_k[i] + w[i];
+    t2   = (_ror(v[0], 2) ^ _ror(v[0], 13) ^ _ror(v[0], 22)) +
+           ((v[0] & v[1]) | (v[2] & (v[0] | v[1])));
+    v[7] = v[6];
+    v[6] = v[5];
+    v[5] = v[4];
+    v[4] = v[3] + t1;
+    v[3] = v[2];
+    v[2] = v[1];
+    v[1] = v[0];
+    v[0] = t1 + t2;
+  }
+  for (i = 0; i < 8; ++i) { ctx->state[i] += v[i]; }
+}
+
+static void _sha256_start(sha256* ctx) {
+  static uint32_t const init[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+                                    0xA54FF53A, 0x510E527F, 0x9B05688C,
+                                    0x1F83D9AB, 0x5BE0CD19 };
+  memcpy(ctx->state, init, sizeof init);
+  ctx->length = 0;
+}
+
+static void
+_sha256_update(sha256* ctx, unsigned char const* buf, size_t len) {
+  size_t used;
+
+  while (len-- != 0) {
+    used             = (size_t)(ctx->length++ % 64);
+    ctx->block[used] = *buf++;
+    if (used == 63) {
+      _sha256_block(ctx, ctx->block);
+    }
+  }
+}
+
+static void _sha256_finish(sha256* ctx, unsigned char* digest) {
+  uint64_t      bits = ctx->length * 8;
+  unsigned char pad  = 0x80;
+  int           i;
+
+  _sha256_update(ctx, &pad, 1);
+  for (pad = 0; ctx->length % 64 != 56;) { _sha256_update(ctx, &pad, 1); }
+  for (i = 7; i >= 0; --i) {
+    pad = (unsigned char)(bits >> (i * 8));
+    _sha256_update(ctx, &pad, 1);
+  }
+  for (i = 0; i < 32; ++i) {
+    digest[i] = (unsigned char)(ctx->state[i / 4] >> (24 - i % 4 * 8));
+  }
+}
+
+/* Inner node of Merkle tree */
+static void _merkle_node(
+    unsigned char* node, unsigned char const* left, unsigned char const* right
+) {
+  unsigned char tag = MERKLE_NODE;
+  sha256        ctx;
+
+  _sha256_start(&ctx);
+  _sha256_update(&ctx, &tag, 1);
+  _sha256_update(&ctx, left, SHA256_SIZE);
+  _sha256_update(&ctx, right, SHA256_SIZE);
+  _sha256_finish(&ctx, node);
+}
+
+/* Fold leaves level by level, odd node goes to the next level as is */
+static void _merkle_root(unsigned char* nodes, size_t count) {
+  size_t i;
+
+  for (; count > 1; count = (count + 1) / 2) {
+    for (i = 0; i + 1 < count; i += 2) {
+      _merkle_node(
+          nodes + i / 2 * SHA256_SIZE, nodes + i * SHA256_SIZE,
+          nodes + (i + 1) * SHA256_SIZE
+      );
+    }
+    if (count % 2 != 0) {
+      memmove(
+          nodes + count / 2 * SHA256_SIZE, nodes + (count - 1) * SHA256_SIZE,
+          SHA256_SIZE
+      );
+    }
+  }
+}
+
+static int _compare_hash(void const* lhs, void const* rhs) {
+  uint32_t l = ((member const*)lhs)->hash;
+  uint32_t r = ((member const*)rhs)->hash;
+  return l < r ? -1 : l > r;
+}
+
+/* Write ustar header */
+static int
+_write_header(FILE* out, char const* name, uint32_t size, char typeflag) {
+  unsigned char hdr[BLOCK_SIZE];
+  unsigned      sum;
+  size_t        i;
+
+  if (strlen(name) >= 100) {
+    fprintf(stderr, "mkramfs: name is too long: %s\n", name);
+    return 0;
+  }
+
+  memset(hdr, 0, sizeof hdr);
+  memcpy(hdr, name, strlen(name));
+  sprintf((char*)hdr + 100, "%07o", 0644);
+  sprintf((char*)hdr + 108, "%07o", 0);
+  sprintf((char*)hdr + 116, "%07o", 0);
+  sprintf((char*)hdr + 124, "%011lo", (unsigned long)size);
+  sprintf((char*)hdr + 136, "%011o", 0);
+  hdr[156] = typeflag;
+  memcpy(hdr + 257, "ustar", 6);
+  memcpy(hdr + 263, "00", 2);
+
+  /* Checksum is counted with checksum field filled with spaces */
+  memset(hdr + 148, ' ', 8);
+  for (sum = 0, i = 0; i < sizeof hdr; ++i) { sum += hdr[i]; }
+  sprintf((char*)hdr + 148, "%06o", sum);
+  hdr[155] = ' ';
+
+  return fwrite(hdr, sizeof hdr, 1, out) == 1;
+}
+
+/* Zero block for padding and end of archive */
+static unsigned char const _zero[BLOCK_SIZE];
+
+/* Pad member data to block size */
+static int _write_padding(FILE* out, uint32_t size) {
+  size_t pad = _align512(size) - size;
+  return pad == 0 || fwrite(_zero, pad, 1, out) == 1;
+}
+
+/* Write pax extended header with a comment, which fills pad bytes */
+static int _write_pax_pad(FILE* out, uint32_t pad) {
+  char     record[PAGE_SIZE];
+  uint32_t len = pad - BLOCK_SIZE;
+  int      prefix;
+
+  if (!_write_header(out, "ramfs/.pad", len, 'x')) {
+    return 0;
+  }
+  if (len == 0) {
+    return 1;
+  }
+
+  /* Record is "<length> comment=<filler>\n", length counts itself */
+  prefix = sprintf(record, "%lu comment=", (unsigned long)len);
+  memset(record + prefix, '.', len - prefix - 1);
+  record[len - 1] = '\n';
+  return fwrite(record, len, 1, out) == 1;
+}
+
+/* Size of PE image in memory, if it can be run in place */
+static uint32_t _pe_image_size(char const* name) {
+  unsigned char hdr[PAGE_SIZE];
+  size_t        len;
+  uint32_t      pe, opt;
+  FILE*         in;
+
+  if ((in = fopen(name, "rb")) == NULL) {
+    return 0;
+  }
+  len = fread(hdr, 1, sizeof hdr, in);
+  fclose(in);
+
+  /* MZ, PE signature and PE32+ optional header */
+  if (len < 0x40 || hdr[0] != 'M' || hdr[1] != 'Z') {
+    return 0;
+  }
+  pe  = _get32(hdr + 0x3C);
+  opt = pe + 24;
+  if (opt + 60 > len || memcmp(hdr + pe, "PE\0\0", 4) != 0 ||
+      hdr[opt] != 0x0B || hdr[opt + 1] != 0x02) {
+    return 0;
+  }
+
+  /* Section and file alignment must be equal and whole pages */
+  if (_get32(hdr + opt + 32) != _get32(hdr + opt + 36) ||
+      _get32(hdr + opt + 32) % PAGE_SIZE != 0) {
+    return 0;
+  }
+  return _get32(hdr + opt + 56);
+}
+
+/* Size of ELF64 image in memory, if it can be run in place */
+static uint32_t _elf_image_size(char const* name) {
+  unsigned char        hdr[PAGE_SIZE];
+  unsigned char const* ph;
+  size_t               len;
+  uint64_t             phoff, base = UINT64_MAX, end = 0;
+  uint32_t             phnum, i;
+  FILE*                in;
+
+  if ((in = fopen(name, "rb")) == NULL) {
+    return 0;
+  }
+  len = fread(hdr, 1, sizeof hdr, in);
+  fclose(in);
+
+  /* ELF64, little endian, x86-64, program headers in the first page */
+  if (len < 64 || memcmp(hdr, "\177ELF", 4) != 0 || hdr[4] != 2 ||
+      hdr[5] != 1 || _get16(hdr + 18) != 62 || _get16(hdr + 54) != 56) {
+    return 0;
+  }
+  phoff = _get64(hdr + 32);
+  phnum = _get16(hdr + 56);
+  if (phoff + (uint64_t)phnum * 56 > len) {
+    return 0;
+  }
+
+  /* Find page aligned base of PT_LOAD segments */
+  for (i = 0, ph = hdr + phoff; i < phnum; ++i, ph += 56) {
+    if (_get32(ph) == 1 && _get64(ph + 16) < base) {
+      base = _get64(ph + 16);
+    }
+  }
+  base &= ~(uint64_t)(PAGE_SIZE - 1);
+
+  /* Each segment must be at the same offset in file and in memory */
+  for (i = 0, ph = hdr + phoff; i < phnum; ++i, ph += 56) {
+    if (_get32(ph) != 1) {
+      continue;
+    }
+    if (_get64(ph + 8) != _get64(ph + 16) - base) {
+      return 0;
+    }
+    if (_get64(ph + 8) + _get64(ph + 40) > end) {
+      end = _get64(ph + 8) + _get64(ph + 40);
+    }
+  }
+
+  return end <= UINT32_MAX ? (uint32_t)end : 0;
+}
+
+static int _copy_file(FILE* out, member const* m) {
+  unsigned char buf[64 * 1024];
+  size_t        len;
+  uint32_t      left = m->file_size;
+  FILE*         in;
+
+  if ((in = fopen(m->name, "rb")) == NULL) {
+    perror(m->name);
+    return 0;
+  }
+  while (left != 0 && (len = fread(buf, 1, sizeof buf, in)) != 0) {
+    if (len > left) {
+      len = left;
+    }
+    if (fwrite(buf, len, 1, out) != 1) {
+      fclose(in);
+      return 0;
+    }
+    left -= (uint32_t)len;
+  }
+  fclose(in);
+
+  if (left != 0) {
+    fprintf(stderr, "mkramfs: %s changed while packing\n", m->name);
+    return 0;
+  }
+
+  /* Zero fill up to image size */
+  for (left = m->size - m->file_size; left != 0; left -= (uint32_t)len) {
+    len = left < BLOCK_SIZE ? left : BLOCK_SIZE;
+    if (fwrite(_zero, len, 1, out) != 1) {
+      return 0;
+    }
+  }
+  return _write_padding(out, m->size);
+}
+
+static uint32_t
+_crc32_update(uint32_t crc, unsigned char const* buf, size_t len) {
+  int i;
+
+  crc = ~crc;
+  while (len-- != 0) {
+    crc ^= *buf++;
+    for (i = 0; i < 8; ++i) { crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1)); }
+  }
+  return ~crc;
+}
+
+/* CRC32 and Merkle leaf of member data, as it will be in the archive */
+static int _digest_file(member* m) {
+  unsigned char buf[64 * 1024];
+  unsigned char tag = MERKLE_LEAF;
+  size_t        len;
+  uint32_t      left = m->file_size;
+  sha256        ctx;
+  FILE*         in;
+
+  if ((in = fopen(m->name, "rb")) == NULL) {
+    perror(m->name);
+    return 0;
+  }
+
+  /* Leaf covers the name too, so files can't be swapped */
+  _sha256_start(&ctx);
+  _sha256_update(&ctx, &tag, 1);
+  _sha256_update(&ctx, (unsigned char const*)m->name, strlen(m->name) + 1);
+
+  m->crc = 0;
+  while (left != 0 && (len = fread(buf, 1, sizeof buf, in)) != 0) {
+    if (len > left) {
+      len = left;
+    }
+    _sha256_update(&ctx, buf, len);
+    m->crc  = _crc32_update(m->crc, buf, len);
+    left   -= (uint32_t)len;
+  }
+  fclose(in);
+
+  if (left != 0) {
+    fprintf(stderr, "mkramfs: can't read %s\n", m->name);
+    return 0;
+  }
+  for (left = m->size - m->file_size; left != 0; left -= (uint32_t)len) {
+    len    = left < BLOCK_SIZE ? left : BLOCK_SIZE;
+    m->crc = _crc32_update(m->crc, _zero, len);
+    _sha256_update(&ctx, _zero, len);
+  }
+
+  _sha256_finish(&ctx, m->leaf);
+  return 1;
+}
+
+static int _file_size(char const* name, uint32_t* size) {
+  FILE* in;
+  long  len;
+
+  if ((in = fopen(name, "rb")) == NULL) {
+    perror(name);
+    return 0;
+  }
+  if (fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) < 0 ||
+      (unsigned long)len > 0x7FFFFFFFUL) {
+    fprintf(stderr, "mkramfs: can't get size of %s\n", name);
+    fclose(in);
+    return 0;
+  }
+  fclose(in);
+
+  *size = (uint32_t)len;
+  return 1;
+}
+
+static void _usage(void) {
+  fprintf(stderr, "Usage: mkramfs [-a] [-c] [-m] -o <archive> <file>...\n");
+}
+
+#endif /* DOX_SKIP */
+
+int main(int argc, char** argv) {
+  char const*    output = NULL;
+  char**         files;
+  int            align = 0;
+  int            crc    = 0;
+  int            merkle = 0;
+  member*        members;
+  member*        sorted;
+  size_t         count, i, j;
+  uint32_t       offset, index_size, manifest_size, image_size;
+  unsigned char* index;
+  unsigned char* manifest;
+  unsigned char* nodes;
+  unsigned char  root[SHA256_SIZE];
+  FILE*          out;
+  int            ok;
+
+  for (files = argv + 1; *files != NULL && (*files)[0] == '-'; ++files) {
+    if (strcmp(*files, "-a") == 0) {
+      align = 1;
+    } else if (strcmp(*files, "-c") == 0) {
+      crc = 1;
+    } else if (strcmp(*files, "-m") == 0) {
+      merkle = 1;
+    } else if (strcmp(*files, "-o") == 0 && files[1] != NULL) {
+      output = *++files;
+    } else {
+      _usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (output == NULL || *files == NULL) {
+    _usage();
+    return EXIT_FAILURE;
+  }
+  count      = (size_t)(argc - (files - argv));
+  index_size    = 16 + 16 * (uint32_t)count;
+  manifest_size = 48 + SHA256_SIZE * (uint32_t)count;
+
+  members       = calloc(count, sizeof(member));
+  sorted        = calloc(count, sizeof(member));
+  index         = calloc(1, _align512(index_size));
+  manifest      = calloc(1, _align512(manifest_size));
+  nodes         = calloc(count, SHA256_SIZE);
+  if (members == NULL || sorted == NULL || index == NULL ||
+      manifest == NULL || nodes == NULL) {
+    perror("mkramfs");
+    return EXIT_FAILURE;
+  }
+
+  /* Index and manifest go first, files follow in command line order */
+  offset = BLOCK_SIZE + _align512(index_size);
+  if (merkle) {
+    offset += BLOCK_SIZE + _align512(manifest_size);
+  }
+  for (i = 0; i < count; ++i) {
+    members[i].name = files[i];
+    if (!_file_size(members[i].name, &members[i].file_size)) {
+      return EXIT_FAILURE;
+    }
+    members[i].size = members[i].file_size;
+    if (strcmp(members[i].name, INDEX_NAME) == 0 ||
+        strcmp(members[i].name, MANIFEST_NAME) == 0) {
+      fprintf(stderr, "mkramfs: %s is reserved\n", members[i].name);
+      return EXIT_FAILURE;
+    }
+    for (j = 0; j < i; ++j) {
+      if (strcmp(members[i].name, members[j].name) == 0) {
+        fprintf(stderr, "mkramfs: duplicate file %s\n", members[i].name);
+        return EXIT_FAILURE;
+      }
+    }
+
+    if (align) {
+      /* Data follows the header, so header ends on page boundary */
+      members[i].pad  = (PAGE_SIZE - (offset + BLOCK_SIZE) % PAGE_SIZE) %
+                       PAGE_SIZE;
+      offset         += members[i].pad;
+
+      image_size      = _pe_image_size(members[i].name);
+      if (image_size == 0) {
+        image_size = _elf_image_size(members[i].name);
+      }
+      if (image_size > members[i].size) {
+        members[i].size = image_size;
+      }
+    }
+
+    if ((crc || merkle) && !_digest_file(&members[i])) {
+      return EXIT_FAILURE;
+    }
+
+    members[i].hash    = _hash(members[i].name);
+    members[i].offset  = offset + BLOCK_SIZE;
+    offset            += BLOCK_SIZE + _align512(members[i].size);
+  }
+
+  /* Index: magic, version, count, flags, then entries sorted by hash:
+   * hash, data offset, data size, CRC32 of data or zero */
+  memcpy(sorted, members, count * sizeof(member));
+  qsort(sorted, count, sizeof(member), _compare_hash);
+  _put32(index, INDEX_MAGIC);
+  _put32(index + 4, INDEX_VERSION);
+  _put32(index + 8, (uint32_t)count);
+  _put32(index + 12, crc ? INDEX_CRC32 : 0);
+  for (i = 0; i < count; ++i) {
+    _put32(index + 16 + 16 * i, sorted[i].hash);
+    _put32(index + 20 + 16 * i, sorted[i].offset);
+    _put32(index + 24 + 16 * i, sorted[i].size);
+    _put32(index + 28 + 16 * i, crc ? sorted[i].crc : 0);
+  }
+
+  /* Manifest: magic, version, count, reserved, Merkle root, then leaves in
+   * the order of index entries */
+  if (merkle) {
+    _put32(manifest, MANIFEST_MAGIC);
+    _put32(manifest + 4, MANIFEST_VERSION);
+    _put32(manifest + 8, (uint32_t)count);
+    for (i = 0; i < count; ++i) {
+      memcpy(manifest + 48 + SHA256_SIZE * i, sorted[i].leaf, SHA256_SIZE);
+    }
+    memcpy(nodes, manifest + 48, SHA256_SIZE * count);
+    _merkle_root(nodes, count);
+    memcpy(root, nodes, SHA256_SIZE);
+    memcpy(manifest + 16, root, SHA256_SIZE);
+  }
+
+  if ((out = fopen(output, "wb")) == NULL) {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+  ok = _write_header(out, INDEX_NAME, index_size, '0') &&
+       fwrite(index, _align512(index_size), 1, out) == 1;
+  ok = ok && (!merkle ||
+              (_write_header(out, MANIFEST_NAME, manifest_size, '0') &&
+               fwrite(manifest, _align512(manifest_size), 1, out) == 1));
+  for (i = 0; ok && i < count; ++i) {
+    ok = (members[i].pad == 0 || _write_pax_pad(out, members[i].pad)) &&
+         _write_header(out, members[i].name, members[i].size, '0') &&
+         _copy_file(out, &members[i]);
+  }
+
+  /* End of archive */
+  ok = ok && fwrite(_zero, BLOCK_SIZE, 1, out) == 1 &&
+       fwrite(_zero, BLOCK_SIZE, 1, out) == 1;
+  ok = fclose(out) == 0 && ok;
+
+  free(nodes);
+  free(manifest);
+  free(index);
+  free(sorted);
+  free(members);
+
+  if (!ok) {
+    fprintf(stderr, "mkramfs: failed to write %s\n", output);
+    remove(output);
+    return EXIT_FAILURE;
+  }
+
+  /* Root is what TSL is built to trust, see RAMFS_ROOT_HASH */
+  if (merkle) {
+    for (i = 0; i < SHA256_SIZE; ++i) { printf("%02X", root[i]); }
+    printf("\n");
+  }
+  return EXIT_SUCCESS;
+}
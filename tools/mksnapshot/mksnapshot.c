@@ -0,0 +1,496 @@
+/**
+ * @file mksnapshot.c
+ * @author Arseny Lashkevich (arsenez@cybercommunity.space)
+ * @brief Host tool for making prelinked boot snapshots
+ * @details Loads kernel and DLLs it imports, the same way TSL does, into one
+ * image linked for a fixed physical address: sections are placed, base
+ * relocations applied and import address tables filled. TSL copies the
+ * snapshot there as a whole, instead of loading modules one by one.
+ *
+ * Snapshot carries CRC32 of module names and whole module files. If modules
+ * in RAMFS don't match it, TSL ignores the snapshot and loads them as usual.
+ *
+ * Usage: mksnapshot -b <address> -o <snapshot> <kernel>
+ * Kernel and DLLs are read from the names they have in RAMFS, e.g.
+ * `ramfs/kernel`. Snapshot must be packed to RAMFS as `ramfs/.snapshot`
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Leave this undocumented */
+#ifndef DOX_SKIP
+
+#  define PAGE_SIZE        4096
+
+/* Must match TSL/src/snapshot.c */
+#  define SNAPSHOT_MAGIC   0x504E5356UL /* "VSNP" */
+#  define SNAPSHOT_VERSION 2
+#  define HEADER_SIZE      40
+#  define RECORD_SIZE      24
+#  define CRC32_POLY       0xEDB88320UL
+
+/* PE layout */
+#  define OPT_HEADER       24
+#  define DATA_DIRECTORIES 112
+#  define SECTION_SIZE     40
+#  define DIRECTORY_EXPORT 0
+#  define DIRECTORY_IMPORT 1
+#  define DIRECTORY_RELOC  5
+
+typedef struct module {
+  char*    name;
+  uint32_t offset; /* Offset from snapshot base */
+  uint32_t image_size;
+  uint32_t entry;
+  uint32_t stack_size;
+  uint32_t file_size;
+} module;
+
+static struct {
+  uint64_t       base;
+  unsigned char* image;
+  uint32_t       image_size;
+  module*        modules;
+  size_t         count;
+  uint32_t       checksum;
+} _ctx;
+
+static uint32_t _align_page(uint32_t val) {
+  return (val + PAGE_SIZE - 1) & ~(uint32_t)(PAGE_SIZE - 1);
+}
+
+static uint32_t _get16(unsigned char const* buf) {
+  return (uint32_t)buf[0] | (uint32_t)buf[1] << 8;
+}
+
+static uint32_t _get32(unsigned char const* buf) {
+  return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 |
+         (uint32_t)buf[3] << 24;
+}
+
+static uint64_t _get64(unsigned char const* buf) {
+  return (uint64_t)_get32(buf) | (uint64_t)_get32(buf + 4) << 32;
+}
+
+static void _put32(unsigned char* buf, uint32_t val) {
+  buf[0] = (unsigned char)val;
+  buf[1] = (unsigned char)(val >> 8);
+  buf[2] = (unsigned char)(val >> 16);
+  buf[3] = (unsigned char)(val >> 24);
+}
+
+static void _put64(unsigned char* buf, uint64_t val) {
+  _put32(buf, (uint32_t)val);
+  _put32(buf + 4, (uint32_t)(val >> 32));
+}
+
+/* Continue CRC32 the same way TSL crc32_update() does */
+static uint32_t _crc32_update(uint32_t crc, void const* data, size_t size) {
+  unsigned char const* byte = data;
+  int                  i;
+
+  crc = ~crc;
+  while (size-- != 0) {
+    crc ^= *byte++;
+    for (i = 0; i < 8; ++i) { crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1)); }
+  }
+  return ~crc;
+}
+
+static unsigned char* _read_file(char const* name, uint32_t* size) {
+  unsigned char* data;
+  FILE*          in;
+  long           len;
+
+  if ((in = fopen(name, "rb")) == NULL) {
+    perror(name);
+    return NULL;
+  }
+  if (fseek(in, 0, SEEK_END) != 0 || (len = ftell(in)) < 0 ||
+      (unsigned long)len > 0x7FFFFFFFUL || fseek(in, 0, SEEK_SET) != 0 ||
+      (data = malloc(len != 0 ? (size_t)len : 1)) == NULL) {
+    fprintf(stderr, "mksnapshot: can't read %s\n", name);
+    fclose(in);
+    return NULL;
+  }
+  if (fread(data, 1, (size_t)len, in) != (size_t)len) {
+    fprintf(stderr, "mksnapshot: can't read %s\n", name);
+    free(data);
+    fclose(in);
+    return NULL;
+  }
+  fclose(in);
+
+  *size = (uint32_t)len;
+  return data;
+}
+
+/* Grow snapshot image by zeroed pages */
+static int _grow_image(uint32_t size) {
+  unsigned char* image = realloc(_ctx.image, _ctx.image_size + size);
+  if (image == NULL) {
+    perror("mksnapshot");
+    return 0;
+  }
+  memset(image + _ctx.image_size, 0, size);
+  _ctx.image       = image;
+  _ctx.image_size += size;
+  return 1;
+}
+
+/* Apply base relocations to image at offset, delta bytes away from its base */
+static int _relocate(uint32_t offset, uint32_t pe, uint64_t delta) {
+  unsigned char* mem  = _ctx.image + offset;
+  unsigned char* dir  = mem + pe + OPT_HEADER + DATA_DIRECTORIES;
+  uint32_t       size = _get32(mem + pe + OPT_HEADER + 56);
+  uint32_t       block, end, block_size, i, entry, target;
+
+  block = _get32(dir + DIRECTORY_RELOC * 8);
+  end   = block + _get32(dir + DIRECTORY_RELOC * 8 + 4);
+  if (end < block || end > size) {
+    return 0;
+  }
+
+  for (; block + 8 <= end; block += block_size) {
+    block_size = _get32(mem + block + 4);
+    if (block_size < 8 || block_size > end - block) {
+      return 0;
+    }
+    for (i = 8; i + 2 <= block_size; i += 2) {
+      entry  = _get16(mem + block + i);
+      target = _get32(mem + block) + (entry & 0xFFF);
+      switch (entry >> 12) {
+      case 10: /* DIR64 */
+        if (target + 8 > size) {
+          return 0;
+        }
+        _put64(mem + target, _get64(mem + target) + delta);
+        break;
+      case 3: /* HIGHLOW */
+        if (target + 4 > size) {
+          return 0;
+        }
+        _put32(mem + target, _get32(mem + target) + (uint32_t)delta);
+        break;
+      case 0: /* ABSOLUTE */ break;
+      default: return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/* Find export index of symbol by name */
+static int _find_export(
+    unsigned char const* dll, uint32_t export_dir, char const* name,
+    uint32_t* index
+) {
+  uint32_t count = _get32(dll + export_dir + 24);
+  uint32_t names = _get32(dll + export_dir + 32);
+  uint32_t ords  = _get32(dll + export_dir + 36);
+  uint32_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (strcmp((char const*)dll + _get32(dll + names + 4 * i), name) == 0) {
+      *index = _get16(dll + ords + 2 * i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int _load(char const* name, size_t* index);
+
+/* Bind imports of module at offset */
+static int _bind(uint32_t offset, uint32_t pe) {
+  unsigned char* mem  = _ctx.image + offset;
+  uint32_t       dirs = pe + OPT_HEADER + DATA_DIRECTORIES;
+  unsigned char* dll_mem;
+  char           dll_path[256];
+  size_t         dll;
+  uint32_t       desc, export_dir, iat, export_index;
+  uint64_t       symbol;
+
+  if (_get32(mem + dirs + DIRECTORY_IMPORT * 8 + 4) == 0) {
+    return 1;
+  }
+
+  for (desc = _get32(mem + dirs + DIRECTORY_IMPORT * 8);
+       _get32(mem + desc) != 0;
+       desc += 20) {
+    snprintf(
+        dll_path,
+        sizeof dll_path,
+        "ramfs/%s",
+        (char const*)mem + _get32(mem + desc + 12)
+    );
+    if (!_load(dll_path, &dll)) {
+      return 0;
+    }
+
+    /* Image is reallocated while DLLs are loaded */
+    mem        = _ctx.image + offset;
+    dll_mem    = _ctx.image + _ctx.modules[dll].offset;
+    export_dir = _get32(
+        dll_mem + _get32(dll_mem + 0x3C) + OPT_HEADER + DATA_DIRECTORIES +
+        DIRECTORY_EXPORT * 8
+    );
+    if (export_dir == 0) {
+      fprintf(stderr, "mksnapshot: %s has no exports\n", dll_path);
+      return 0;
+    }
+
+    for (iat = _get32(mem + desc + 16); (symbol = _get64(mem + iat)) != 0;
+         iat += 8) {
+      if (symbol & (1ULL << 63)) {
+        /* Import by ordinal */
+        export_index = (uint32_t)(symbol & 0xFFFF) -
+                       _get32(dll_mem + export_dir + 16);
+      } else if (!_find_export(
+                     dll_mem,
+                     export_dir,
+                     (char const*)mem + (uint32_t)symbol + 2,
+                     &export_index
+                 )) {
+        fprintf(
+            stderr,
+            "mksnapshot: %s doesn't export %s\n",
+            dll_path,
+            (char const*)mem + (uint32_t)symbol + 2
+        );
+        return 0;
+      }
+
+      if (export_index >= _get32(dll_mem + export_dir + 20)) {
+        fprintf(stderr, "mksnapshot: bad import from %s\n", dll_path);
+        return 0;
+      }
+      _put64(
+          mem + iat,
+          _ctx.base + _ctx.modules[dll].offset +
+              _get32(
+                  dll_mem + _get32(dll_mem + export_dir + 28) +
+                  4 * export_index
+              )
+      );
+    }
+  }
+
+  return 1;
+}
+
+/* Load PE32+ image to the end of snapshot */
+static int _load(char const* name, size_t* index) {
+  unsigned char* file;
+  unsigned char* mem;
+  unsigned char* section;
+  module*        modules;
+  uint32_t       file_size, pe, opt, image_size, headers_size, offset;
+  uint32_t       sections_count, raw_size, i;
+  uint64_t       image_base;
+
+  for (i = 0; i < _ctx.count; ++i) {
+    if (strcmp(_ctx.modules[i].name, name) == 0) {
+      *index = i;
+      return 1;
+    }
+  }
+
+  if ((file = _read_file(name, &file_size)) == NULL) {
+    return 0;
+  }
+
+  /* MZ, PE signature and PE32+ optional header with all data directories */
+  pe  = file_size >= 0x40 ? _get32(file + 0x3C) : 0;
+  opt = pe + OPT_HEADER;
+  if (file_size < 0x40 || file[0] != 'M' || file[1] != 'Z' ||
+      pe > file_size || opt + DATA_DIRECTORIES + 16 * 8 > file_size ||
+      memcmp(file + pe, "PE\0\0", 4) != 0 || _get16(file + opt) != 0x020B) {
+    fprintf(stderr, "mksnapshot: %s isn't a PE32+ image\n", name);
+    free(file);
+    return 0;
+  }
+  image_size     = _get32(file + opt + 56);
+  headers_size   = _get32(file + opt + 60);
+  image_base     = _get64(file + opt + 24);
+  sections_count = _get16(file + pe + 6);
+  section        = file + opt + _get16(file + pe + 20);
+  if (headers_size > file_size) {
+    headers_size = file_size;
+  }
+  if (headers_size > image_size || _get32(file + opt + 16) >= image_size ||
+      (uint64_t)(section - file) + sections_count * SECTION_SIZE >
+          file_size) {
+    fprintf(stderr, "mksnapshot: %s is malformed\n", name);
+    free(file);
+    return 0;
+  }
+
+  /* TSL checks the same bytes */
+  _ctx.checksum = _crc32_update(_ctx.checksum, name, strlen(name) + 1);
+  _ctx.checksum = _crc32_update(_ctx.checksum, file, file_size);
+
+  /* Lay out image */
+  offset = _ctx.image_size;
+  if (!_grow_image(_align_page(image_size))) {
+    free(file);
+    return 0;
+  }
+  mem = _ctx.image + offset;
+  memcpy(mem, file, headers_size);
+  for (i = 0; i < sections_count; ++i, section += SECTION_SIZE) {
+    raw_size = _get32(section + 16);
+    if (_get32(section + 8) != 0 && raw_size > _get32(section + 8)) {
+      raw_size = _get32(section + 8);
+    }
+    if (_get32(section + 20) > file_size ||
+        raw_size > file_size - _get32(section + 20) ||
+        _get32(section + 12) > image_size ||
+        raw_size > image_size - _get32(section + 12)) {
+      fprintf(stderr, "mksnapshot: %s is malformed\n", name);
+      free(file);
+      return 0;
+    }
+    memcpy(mem + _get32(section + 12), file + _get32(section + 20), raw_size);
+  }
+  free(file);
+
+  if (_ctx.base + offset != image_base) {
+    if ((_get16(mem + pe + 22) & 0x0001) ||
+        !_relocate(offset, pe, _ctx.base + offset - image_base)) {
+      fprintf(stderr, "mksnapshot: can't relocate %s\n", name);
+      return 0;
+    }
+  }
+
+  /* Register module before binding, so cyclic imports find it */
+  if ((modules = realloc(_ctx.modules, (_ctx.count + 1) * sizeof(module))) ==
+      NULL) {
+    perror("mksnapshot");
+    return 0;
+  }
+  _ctx.modules = modules;
+  if ((modules[_ctx.count].name = malloc(strlen(name) + 1)) == NULL) {
+    perror("mksnapshot");
+    return 0;
+  }
+  strcpy(modules[_ctx.count].name, name);
+  modules[_ctx.count].offset     = offset;
+  modules[_ctx.count].image_size = image_size;
+  modules[_ctx.count].entry      = offset + _get32(mem + opt + 16);
+  modules[_ctx.count].stack_size = (uint32_t)_get64(mem + opt + 80);
+  modules[_ctx.count].file_size  = file_size;
+  *index                         = _ctx.count++;
+
+  return _bind(offset, pe);
+}
+
+static int _write_snapshot(char const* output) {
+  unsigned char* hdr;
+  uint32_t       names_offset, names_size, data_offset, data_size;
+  size_t         i;
+  FILE*          out;
+  int            ok;
+
+  names_offset = HEADER_SIZE + RECORD_SIZE * (uint32_t)_ctx.count;
+  for (i = 0, names_size = 0; i < _ctx.count; ++i) {
+    names_size += (uint32_t)strlen(_ctx.modules[i].name) + 1;
+  }
+  data_offset = _align_page(names_offset + names_size);
+
+  /* Trailing zeros are cleared by TSL */
+  for (data_size = _ctx.image_size;
+       data_size != 0 && _ctx.image[data_size - 1] == 0;
+       --data_size)
+    ;
+
+  if ((hdr = calloc(1, data_offset)) == NULL) {
+    perror("mksnapshot");
+    return 0;
+  }
+  _put32(hdr, SNAPSHOT_MAGIC);
+  _put32(hdr + 4, SNAPSHOT_VERSION);
+  _put32(hdr + 8, _ctx.checksum);
+  _put32(hdr + 12, (uint32_t)_ctx.count);
+  _put64(hdr + 16, _ctx.base);
+  _put32(hdr + 24, _ctx.image_size);
+  _put32(hdr + 28, data_offset);
+  _put32(hdr + 32, data_size);
+  for (i = 0; i < _ctx.count; ++i) {
+    unsigned char* record = hdr + HEADER_SIZE + RECORD_SIZE * i;
+    _put32(record, names_offset);
+    _put32(record + 4, _ctx.modules[i].offset);
+    _put32(record + 8, _ctx.modules[i].image_size);
+    _put32(record + 12, _ctx.modules[i].entry);
+    _put32(record + 16, _ctx.modules[i].stack_size);
+    _put32(record + 20, _ctx.modules[i].file_size);
+    strcpy((char*)hdr + names_offset, _ctx.modules[i].name);
+    names_offset += (uint32_t)strlen(_ctx.modules[i].name) + 1;
+  }
+
+  if ((out = fopen(output, "wb")) == NULL) {
+    perror(output);
+    free(hdr);
+    return 0;
+  }
+  ok = fwrite(hdr, data_offset, 1, out) == 1 &&
+       (data_size == 0 || fwrite(_ctx.image, data_size, 1, out) == 1);
+  ok = fclose(out) == 0 && ok;
+  free(hdr);
+
+  if (!ok) {
+    fprintf(stderr, "mksnapshot: failed to write %s\n", output);
+    remove(output);
+  }
+  return ok;
+}
+
+static void _usage(void) {
+  fprintf(stderr, "Usage: mksnapshot -b <address> -o <snapshot> <kernel>\n");
+}
+
+#endif /* DOX_SKIP */
+
+int main(int argc, char** argv) {
+  char const* output = NULL;
+  char const* base   = NULL;
+  char*       end;
+  size_t      kernel;
+  int         i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      base = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      _usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (output == NULL || base == NULL || i + 1 != argc) {
+    _usage();
+    return EXIT_FAILURE;
+  }
+
+  _ctx.base     = strtoull(base, &end, 0);
+  _ctx.checksum = 0;
+  if (*end != '\0' || _ctx.base % PAGE_SIZE != 0) {
+    fprintf(stderr, "mksnapshot: bad address %s\n", base);
+    return EXIT_FAILURE;
+  }
+
+  if (!_load(argv[i], &kernel)) {
+    return EXIT_FAILURE;
+  }
+  if (_ctx.base + _ctx.image_size > 0x100000000ULL) {
+    fprintf(stderr, "mksnapshot: snapshot doesn't fit below 4GB\n");
+    return EXIT_FAILURE;
+  }
+
+  return _write_snapshot(output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}